@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,6 +6,11 @@
 
 #include "buffered_reader.h"
 #include "mem.h"
+#include "numa.h"
+
+#define STREAM_BUF_SIZE		(1024 * 1024)
+#define ESTIMATE_NR_LINES	1024
+#define ESTIMATE_SIZE		(64 * 1024)
 
 /**
  * @brief Read header.
@@ -27,36 +33,61 @@ static void __read_header(struct buffered_reader *br, size_t header)
 
 		br->header_lines[br->nr_header_lines++] = xstrdup(line);
 	}
+
+	/* free line */
+	xfree(line);
 }
 
 /**
- * @brief Estimate line length.
+ * @brief Estimate line length on first lines (they are kept as pending data, so the input does not need to be seekable).
  * 
  * @param br 			buffered reader
+ * @param first_lines		first lines (output)
+ * @param first_len		first lines length (output)
  *
- * @return line length
+ * @return line length (0 if nothing can be read)
  */
-static size_t __estimate_line_length(struct buffered_reader *br)
+static size_t __estimate_line_length(struct buffered_reader *br, char **first_lines, size_t *first_len)
 {
-	char *line = NULL;
+	size_t len = 0, capacity = 0, nr_lines, record_size;
+	char *line = NULL, *ptr;
 	ssize_t line_len;
-	size_t len;
 
-	/* read first line */
-	line_len = getline(&line, &len, br->fp);
-	if (line_len <= 0) {
-		line_len = 0;
-		goto out;
+	/* binary records : read first record */
+	record_size = line_get_record_size();
+	if (record_size) {
+		*first_len = 0;
+		*first_lines = (char *) malloc(record_size);
+		if (*first_lines)
+			*first_len = fread(*first_lines, 1, record_size, br->fp);
+		return *first_len;
 	}
 
-	/* rewind */
-	fseek(br->fp, -line_len, SEEK_CUR);
+	/* read first lines (a wrong estimate wastes memory or spills chunks early) */
+	*first_lines = NULL;
+	*first_len = 0;
+	for (nr_lines = 0; nr_lines < ESTIMATE_NR_LINES && *first_len < ESTIMATE_SIZE; nr_lines++) {
+		line_len = getline(&line, &len, br->fp);
+		if (line_len <= 0)
+			break;
+
+		if (*first_len + line_len > capacity) {
+			capacity = *first_len + line_len > ESTIMATE_SIZE ? *first_len + line_len : ESTIMATE_SIZE;
+			ptr = (char *) realloc(*first_lines, capacity);
+			if (!ptr) {
+				nr_lines = 0;
+				break;
+			}
 
-out:
-	/* free memory */
-	xfree(line);
+			*first_lines = ptr;
+		}
+
+		memcpy(*first_lines + *first_len, line, line_len);
+		*first_len += line_len;
+	}
 
-	return line_len;
+	xfree(line);
+	return nr_lines ? *first_len / nr_lines : 0;
 }
 
 /**
@@ -73,10 +104,17 @@ out:
 struct buffered_reader *buffered_reader_create(FILE *fp, char field_delim, int key_field, size_t header, ssize_t memory_size)
 {
 	struct buffered_reader *br;
+	char *first_line = NULL, *ptr;
+	size_t first_len, key_size;
 	struct stat st;
 
 	/* allocate reader */
-	br = (struct buffered_reader *) xmalloc(sizeof(struct buffered_reader));
+	br = (struct buffered_reader *) malloc(sizeof(struct buffered_reader));
+	if (!br) {
+		xerror("Can't allocate reader buffer\n");
+		return NULL;
+	}
+
 	br->field_delim = field_delim;
 	br->key_field = key_field;
 	br->fp = fp;
@@ -85,35 +123,68 @@ struct buffered_reader *buffered_reader_create(FILE *fp, char field_delim, int k
 	br->off = 0;
 	br->header_lines = NULL;
 	br->nr_header_lines = 0;
+	br->grow = 0;
+	br->records = 0;
+	br->tags = 0;
+	br->buf_pos = 0;
+	br->bytes_read = 0;
 	
 	/* read header */
 	if (header > 0)
 		__read_header(br, header);
 
 	/* estimate line length */
-	br->line_len = __estimate_line_length(br);
+	br->line_len = __estimate_line_length(br, &first_line, &first_len);
 	if (br->line_len <= 0) {
-		fprintf(stderr, "Can't estimate line length\n");
+		xerror("Can't estimate line length\n");
 		goto err;
 	}
 
+	/* binary records : fixed length (first record may be truncated) */
+	if (line_get_record_size())
+		br->line_len = line_get_record_size();
+
 	/* set buffer capacity */
 	if (memory_size <= 0) {
 		if (fstat(fileno(br->fp), &st)) {
-			fprintf(stderr, "Can't stat input file\n");
+			xerror("Can't stat input file\n");
 			goto err;
 		}
 
-		br->buf_capacity = st.st_size;
+		/* unknown size (pipe, socket...) : grow buffer while reading */
+		if (S_ISREG(st.st_mode) && (size_t) st.st_size >= first_len) {
+			br->buf_capacity = st.st_size;
+		} else {
+			br->buf_capacity = first_len > STREAM_BUF_SIZE ? first_len : STREAM_BUF_SIZE;
+			br->grow = 1;
+		}
 	} else {
-		br->buf_capacity = memory_size - (memory_size / br->line_len) * sizeof(struct line);
+		/* share memory between text, lines index and sort keys */
+		ptr = line_get_record_size() ? NULL : (char *) memchr(first_line, '\n', first_len);
+		key_size = line_key_size(first_line, ptr ? (size_t) (ptr - first_line + 1) : first_len, field_delim, key_field);
+		br->buf_capacity = memory_size / (br->line_len + sizeof(struct line) + key_size) * br->line_len;
+		if (br->buf_capacity < first_len)
+			br->buf_capacity = first_len;
 	}
 
 	/* allocate buffer */
-	br->buf = (char *) xmalloc(br->buf_capacity + 1);
+	br->buf = (char *) mem_alloc_huge(br->buf_capacity + 1);
+	if (!br->buf) {
+		xerror("Can't allocate reader buffer\n");
+		goto err;
+	}
+
+	/* NUMA mode : text is read by all sorting threads, spread it over nodes */
+	numa_interleave(br->buf, br->buf_capacity + 1);
+
+	/* first lines are pending */
+	memcpy(br->buf, first_line, first_len);
+	br->buf_len = br->off = br->bytes_read = first_len;
+	xfree(first_line);
 
 	return br;
 err:
+	xfree(first_line);
 	buffered_reader_free(br);
 	return NULL;
 }
@@ -144,40 +215,205 @@ void buffered_reader_free(struct buffered_reader *br)
 }
 
 /**
- * @brief Read next lines.
+ * @brief Skip to an input offset (pending data is dropped).
+ * 
+ * @param br 			buffered reader
+ * @param off			input offset (start of a line)
+ *
+ * @return status
+ */
+int buffered_reader_seek(struct buffered_reader *br, off_t off)
+{
+	if (fseeko(br->fp, off, SEEK_SET))
+		return -1;
+
+	br->buf_len = 0;
+	br->off = 0;
+	return 0;
+}
+
+/**
+ * @brief Get input offset of pending data (end of lines read so far).
+ * 
+ * @param br 			buffered reader
+ *
+ * @return input offset
+ */
+off_t buffered_reader_tell(struct buffered_reader *br)
+{
+	return ftello(br->fp) - (off_t) br->off;
+}
+
+/**
+ * @brief Share memory again between buffer, lines index and sort keys (a lines array was full : line length was overestimated).
+ * 
+ * @param br 			buffered reader
+ * @param larr			full lines array (lines are not used anymore)
+ * @param memory_size		memory size
+ */
+void buffered_reader_rebalance(struct buffered_reader *br, struct line_array *larr, ssize_t memory_size)
+{
+	size_t line_len, line_size, capacity;
+	char *buf;
+
+	if (larr->size == 0 || br->buf_len <= br->off)
+		return;
+
+	/* measured line length and lines index and sort key size per line */
+	line_len = (br->buf_len - br->off) / larr->size;
+	line_size = sizeof(struct line) + larr->keys_len / larr->size;
+	if (line_len == 0)
+		line_len = 1;
+
+	/* buffer can only shrink (pending data must fit) */
+	capacity = memory_size / (line_len + line_size) * line_len;
+	if (capacity < br->off)
+		capacity = br->off;
+	if (capacity < line_len)
+		capacity = line_len;
+	if (capacity >= br->buf_capacity)
+		return;
+
+	/* move pending data and shrink buffer (a buffer which can't be shrunk is kept as is) */
+	memmove(br->buf, br->buf + br->buf_len - br->off, br->off);
+	br->buf_len = br->off;
+	br->line_len = line_len;
+	buf = (char *) realloc(br->buf, capacity + 1);
+	if (buf) {
+		br->buf = buf;
+		br->buf_capacity = capacity;
+	}
+}
+
+/**
+ * @brief Add a line read in buffer (as a spilled run record, a tag or a plain line).
+ * 
+ * @param br 			buffered reader
+ * @param larr			lines array
+ * @param s			line start
+ * @param len			line length
+ *
+ * @return status (-1 = lines array is full)
+ */
+static inline int __add_line(struct buffered_reader *br, struct line_array *larr, char *s, size_t len)
+{
+	if (br->records)
+		return line_array_add_record(larr, s, len, br->field_delim, br->key_field);
+	else if (br->tags)
+		return line_array_add_tag(larr, s, len, br->buf_pos + (s - br->buf), br->field_delim, br->key_field);
+	else
+		return line_array_add(larr, s, len, br->field_delim, br->key_field);
+}
+
+/**
+ * @brief Cut fixed size binary records (no parsing).
  * 
  * @param br 			buffered reader
  * @param larr			lines array
+ * @param record_size		record size
+ * @param eof			end of input (last truncated record is added) ?
  */
-void buffered_reader_read_lines(struct buffered_reader *br, struct line_array *larr)
+static void __read_records(struct buffered_reader *br, struct line_array *larr, size_t record_size, int eof)
 {
-	char *ptr = NULL, *s;
+	char *s = br->buf, *end = br->buf + br->buf_len;
+
+	/* add records (lines array full : remaining records are kept for next chunk) */
+	for (; s + record_size <= end; s += record_size) {
+		if (__add_line(br, larr, s, record_size)) {
+			br->off = end - s;
+			return;
+		}
+	}
+
+	/* truncated record at end of input (buffer may have been filled up to end of input) */
+	if (s < end && !eof)
+		eof = ungetc(getc(br->fp), br->fp) == EOF;
+	if (eof && s < end && !__add_line(br, larr, s, end - s))
+		s = end;
+
+	/* save last partial record */
+	br->off = end - s;
+}
+
+/**
+ * @brief Read next lines (stops when lines array is full, remaining lines are kept for next call).
+ * 
+ * @param br 			buffered reader
+ * @param larr			lines array
+ *
+ * @return status (-1 if a growing buffer can't hold the whole input)
+ */
+int buffered_reader_read_lines(struct buffered_reader *br, struct line_array *larr)
+{
+	char *ptr = NULL, *s, *buf;
+	int quoted;
 	size_t len;
 
 	/* copy last line */
-	memcpy(br->buf, br->buf + br->buf_len - br->off, br->off);
+	memmove(br->buf, br->buf + br->buf_len - br->off, br->off);
 
 	/* read next chunk */
 	len = fread(br->buf + br->off, 1, br->buf_capacity - br->off, br->fp);
-	if (len <= 0)
-		return;
+
+	/* unknown input size : read everything, growing buffer (no line parsed yet, so buffer can move) */
+	while (br->grow && br->off + len == br->buf_capacity) {
+		buf = (char *) realloc(br->buf, br->buf_capacity * 2 + 1);
+		if (!buf) {
+			xerror("Can't allocate reader buffer\n");
+			return -1;
+		}
+
+		br->buf = buf;
+		br->buf_capacity *= 2;
+		mem_advise_huge(br->buf, br->buf_capacity + 1);
+		numa_interleave(br->buf + br->off + len, br->buf_capacity - br->off - len);
+		len += fread(br->buf + br->off + len, 1, br->buf_capacity - br->off - len, br->fp);
+	}
+
+	br->bytes_read += len;
+
+	/* nothing to parse */
+	if (len <= 0 && br->off == 0)
+		return 0;
 
 	/* end buffer */
 	br->buf_len = br->off + len;
 	br->buf[br->buf_len] = 0;
 	br->off = 0;
 
+	/* tags : input offset of buffer */
+	if (br->tags)
+		br->buf_pos = ftello(br->fp) - (off_t) br->buf_len;
+
+	/* binary records (spilled runs of tags are text) */
+	if (line_get_record_size() && !(br->records && (line_get_key_flags() & LINE_KEY_TAG))) {
+		__read_records(br, larr, line_get_record_size(), feof(br->fp));
+		return 0;
+	}
+
+	/* quoted CSV fields may contain newlines (buffers without quotes take the plain lines path) */
+	quoted = (line_get_key_flags() & LINE_KEY_CSV) && memchr(br->buf, '"', br->buf_len);
+
 	/* parse content */
 	for (s = br->buf; *s != 0;) {
 		/* find end of line */
-		ptr = strchrnul(s, '\n');
+		ptr = quoted ? line_csv_end(s, br->records) : strchrnul(s, '\n');
 
-		/* end of buf */
-		if (!*ptr)
-			break;
+		/* end of buf (last line of input may have no newline : it gets one, buffer has room for it) */
+		if (!*ptr) {
+			if (!feof(br->fp) || ptr == s || br->buf_len == br->buf_capacity)
+				break;
 
-		/* add line */
-		line_array_add(larr, s, ptr - s + 1, br->field_delim, br->key_field);
+			*ptr = '\n';
+			ptr[1] = 0;
+			br->buf_len++;
+		}
+
+		/* add line (lines array full : remaining lines are kept for next chunk) */
+		if (__add_line(br, larr, s, ptr - s + 1)) {
+			br->off = br->buf + br->buf_len - s;
+			return 0;
+		}
 
 		/* go to next line */
 		s = ptr + 1;
@@ -186,4 +422,6 @@ void buffered_reader_read_lines(struct buffered_reader *br, struct line_array *l
 	/* save last line */
 	if (ptr && ptr > s)
 		br->off = ptr - s;
+
+	return 0;
 }
\ No newline at end of file
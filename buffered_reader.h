@@ -20,6 +20,11 @@ struct buffered_reader {
 	char **			header_lines;
 	size_t			nr_header_lines;
 	size_t			line_len;
+	char			grow;
+	char			records;
+	char			tags;
+	off_t			buf_pos;
+	size_t			bytes_read;
 };
 
 /**
@@ -43,11 +48,41 @@ struct buffered_reader *buffered_reader_create(FILE *fp, char field_delim, int k
 void buffered_reader_free(struct buffered_reader *br);
 
 /**
- * @brief Read next lines.
+ * @brief Skip to an input offset (pending data is dropped).
+ * 
+ * @param br 			buffered reader
+ * @param off			input offset (start of a line)
+ *
+ * @return status
+ */
+int buffered_reader_seek(struct buffered_reader *br, off_t off);
+
+/**
+ * @brief Get input offset of pending data (end of lines read so far).
+ * 
+ * @param br 			buffered reader
+ *
+ * @return input offset
+ */
+off_t buffered_reader_tell(struct buffered_reader *br);
+
+/**
+ * @brief Share memory again between buffer, lines index and sort keys (a lines array was full : line length was overestimated).
+ * 
+ * @param br 			buffered reader
+ * @param larr			full lines array (lines are not used anymore)
+ * @param memory_size		memory size
+ */
+void buffered_reader_rebalance(struct buffered_reader *br, struct line_array *larr, ssize_t memory_size);
+
+/**
+ * @brief Read next lines (stops when lines array is full, remaining lines are kept for next call).
  * 
  * @param br 			buffered reader
  * @param larr			lines array
+ *
+ * @return status (-1 if a growing buffer can't hold the whole input)
  */
-void buffered_reader_read_lines(struct buffered_reader *br, struct line_array *larr);
+int buffered_reader_read_lines(struct buffered_reader *br, struct line_array *larr);
 
 #endif
\ No newline at end of file
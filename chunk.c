@@ -1,7 +1,10 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 
 #include "chunk.h"
+#include "tmp_file.h"
+#include "progress.h"
 #include "mem.h"
 
 /**
@@ -9,19 +12,33 @@
  * 
  * @param capacity	capacity
  * 
- * @return chunk
+ * @return chunk (NULL if memory can't be allocated)
  */
 struct chunk *chunk_create(size_t capacity)
 {
 	struct chunk *chunk;
 
-	chunk = (struct chunk *) xmalloc(sizeof(struct chunk));
+	chunk = (struct chunk *) malloc(sizeof(struct chunk));
+	if (!chunk)
+		return NULL;
+
 	chunk->larr = line_array_create(capacity, 1);
+	if (!chunk->larr) {
+		free(chunk);
+		return NULL;
+	}
+
 	chunk->current_line.value = NULL;
 	chunk->current_line.value_len = 0;
 	chunk->fp = NULL;
+	chunk->tmp = NULL;
+	chunk->buf = NULL;
 	chunk->br = NULL;
 	chunk->larr_idx = 0;
+	chunk->check = 0;
+	chunk->last_key = NULL;
+	chunk->last_key_len = -1;
+	chunk->last_key_capacity = 0;
 	chunk->next = NULL;
 
 	return chunk;
@@ -48,9 +65,26 @@ void chunk_free(struct chunk *chunk)
 	/* free memory */
 	chunk_clear_full(chunk);
 	line_array_free(chunk->larr);
+	xfree(chunk->buf);
+	xfree(chunk->last_key);
 	free(chunk);
 }
 
+/**
+ * @brief Free a list of chunks.
+ * 
+ * @param chunks 	chunks
+ */
+void chunk_free_list(struct chunk *chunks)
+{
+	struct chunk *next;
+
+	for (; chunks != NULL; chunks = next) {
+		next = chunks->next;
+		chunk_free(chunks);
+	}
+}
+
 /**
  * @brief Clear a chunk (free lines array).
  * 
@@ -66,38 +100,126 @@ void chunk_clear_full(struct chunk *chunk)
  * @brief Write a chunk on disk.
  * 
  * @param chunk 		chunk
+ * @param path			run file path (NULL = anonymous temporary file)
  *
  * @return status
  */
-static int __chunk_write(struct chunk *chunk)
+static int __chunk_write(struct chunk *chunk, const char *path)
 {
+	size_t size = 0, i;
+
+	/* compute run size */
+	for (i = 0; i < chunk->larr->size; i++)
+		size += chunk->larr->lines[i].value_len;
+
 	/* create temp file */
-	chunk->fp = tmpfile();
+	chunk->fp = tmp_file_create(size, path, &chunk->tmp);
 	if (!chunk->fp) {
-		fprintf(stderr, "Can't create temporary file\n");
+		xerror("Can't create temporary file\n");
 		return -1;
 	}
 
 	/* write lines */
-	return line_array_write(chunk->larr, chunk->fp);
+	if (line_array_write_records(chunk->larr, chunk->fp))
+		return -1;
+
+	/* rewind for merge (flushes and syncs named file) */
+	if (fseeko(chunk->fp, 0, SEEK_SET)) {
+		xerror("Can't write run\n");
+		return -1;
+	}
+
+	return 0;
 }
 
 /**
  * @brief Sort and write a chunk on disk.
  * 
  * @param chunk 		chunk
- * @param fp			output file
  * @param nr_threads		number of threads to use
+ * @param path			run file path (NULL = anonymous temporary file)
  *
  * @return status
  */
-int chunk_sort_write(struct chunk *chunk, size_t nr_threads)
+int chunk_sort_write(struct chunk *chunk, size_t nr_threads, const char *path)
 {
 	/* sort chunk */
 	line_array_sort(chunk->larr, nr_threads);
 
 	/* write chunk */
-	return __chunk_write(chunk);
+	return __chunk_write(chunk, path);
+}
+
+/**
+ * @brief Sort a chunk and keep it in memory (instead of writing it on disk).
+ * 
+ * @param chunk 		chunk
+ * @param br			buffered reader holding chunk lines
+ * @param steal			steal reader buffer (else lines are compacted in a new buffer) ?
+ * @param nr_threads		number of threads to use
+ *
+ * @return status (-1 if compacted lines can't be allocated : chunk is sorted but must be written)
+ */
+int chunk_sort_keep(struct chunk *chunk, struct buffered_reader *br, int steal, size_t nr_threads)
+{
+	struct line *line, *lines;
+	size_t len = 0, i;
+	char *s;
+
+	/* sort chunk */
+	line_array_sort(chunk->larr, nr_threads);
+
+	/* steal reader buffer */
+	if (steal) {
+		chunk->buf = br->buf;
+		br->buf = NULL;
+		br->buf_capacity = 0;
+		return 0;
+	}
+
+	/* compute lines size */
+	for (i = 0; i < chunk->larr->size; i++)
+		len += chunk->larr->lines[i].value_len;
+
+	/* copy lines in sorted order (reader buffer is still allocated : copy may not fit in memory limit) */
+	chunk->buf = s = (char *) malloc(len + 1);
+	if (!chunk->buf)
+		return -1;
+	for (i = 0; i < chunk->larr->size; i++) {
+		line = &chunk->larr->lines[i];
+		memcpy(s, line->value, line->value_len);
+		if (line->key >= line->value && line->key < line->value + line->value_len)
+			line->key = s + (line->key - line->value);
+		line->value = s;
+		s += line->value_len;
+	}
+	*s = 0;
+
+	/* shrink lines array (keep it as is on failure) */
+	lines = (struct line *) realloc(chunk->larr->lines, sizeof(struct line) * chunk->larr->size);
+	if (lines) {
+		chunk->larr->lines = lines;
+		chunk->larr->capacity = chunk->larr->size;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Get memory used by an in memory chunk.
+ * 
+ * @param chunk 		chunk
+ *
+ * @return memory size
+ */
+size_t chunk_memory_size(struct chunk *chunk)
+{
+	size_t len = 0, i;
+
+	for (i = 0; i < chunk->larr->size; i++)
+		len += chunk->larr->lines[i].value_len;
+
+	return len + chunk->larr->capacity * sizeof(struct line) + chunk->larr->keys_capacity;
 }
 
 /**
@@ -107,51 +229,204 @@ int chunk_sort_write(struct chunk *chunk, size_t nr_threads)
  * @param field_delim 		field delimiter
  * @param key_field 		key field
  * @param memory_size		memory size
+ *
+ * @return status
  */
-void chunk_prepare_read(struct chunk *chunk, char field_delim, int key_field, ssize_t memory_size)
+int chunk_prepare_read(struct chunk *chunk, char field_delim, int key_field, ssize_t memory_size)
 {
-	/* rewind */
-	rewind(chunk->fp);
+	/* in memory chunk : lines are already there */
+	if (!chunk->fp) {
+		chunk->larr_idx = 0;
+		chunk_peek_line(chunk);
+		return 0;
+	}
 
 	/* create buffered reader */
 	chunk->br = buffered_reader_create(chunk->fp, field_delim, key_field, 0, memory_size);
+	if (!chunk->br) {
+		chunk->current_line.value = NULL;
+		return -1;
+	}
+
+	/* spilled run : lines are records */
+	chunk->br->records = chunk->tmp != NULL;
 
 	/* clear chunk */
 	chunk_clear_full(chunk);
 
-	/* allocate lines array */
-	chunk->larr->capacity = memory_size / chunk->br->line_len;
-	chunk->larr->lines = (struct line *) xmalloc(sizeof(struct line) * chunk->larr->capacity);
+	/* allocate lines array (bounded : growth failure leaves remaining lines for next read) */
+	chunk->larr->max_memory = memory_size > 0 ? memory_size : 0;
+	chunk->larr->capacity = chunk->br->buf_capacity / chunk->br->line_len + 1;
+	chunk->larr->lines = (struct line *) mem_alloc_huge(sizeof(struct line) * chunk->larr->capacity);
+	if (!chunk->larr->lines) {
+		xerror("Can't allocate run lines\n");
+		chunk->larr->capacity = 0;
+		chunk->current_line.value = NULL;
+		return -1;
+	}
 
 	/* peek first line */
 	chunk_peek_line(chunk);
+
+	return 0;
+}
+
+/**
+ * @brief Save current key (to check order of next line).
+ * 
+ * @param chunk 		chunk
+ *
+ * @return status
+ */
+static int __chunk_save_key(struct chunk *chunk)
+{
+	char *key;
+
+	/* no current line */
+	if (!chunk->current_line.value) {
+		chunk->last_key_len = -1;
+		return 0;
+	}
+
+	/* grow key buffer if needed */
+	if ((size_t) chunk->current_line.key_len > chunk->last_key_capacity) {
+		key = (char *) realloc(chunk->last_key, chunk->current_line.key_len);
+		if (!key) {
+			xerror("Can't allocate key\n");
+			return -1;
+		}
+
+		chunk->last_key = key;
+		chunk->last_key_capacity = chunk->current_line.key_len;
+	}
+
+	/* copy key */
+	memcpy(chunk->last_key, chunk->current_line.key, chunk->current_line.key_len);
+	chunk->last_key_len = chunk->current_line.key_len;
+	return 0;
 }
 
 /**
  * @brief Peek a line from a chunk.
  * 
  * @param chunk 		chunk
+ *
+ * @return status (-1 if chunk is not sorted or its lines can't be allocated)
  */
-void chunk_peek_line(struct chunk *chunk)
+int chunk_peek_line(struct chunk *chunk)
 {
+	struct line last;
+
+	/* save current key (lines buffer may be overwritten) */
+	if (chunk->check && __chunk_save_key(chunk)) {
+		chunk->current_line.value = NULL;
+		return -1;
+	}
+
 	/* read next lines */
 	if (chunk->larr_idx == chunk->larr->size) {
+		/* end of in memory chunk */
+		if (!chunk->br) {
+			chunk->current_line.value = NULL;
+			return 0;
+		}
+
 		/* reset line array */
 		chunk->larr->size = 0;
+		chunk->larr->full = 0;
 		chunk->larr_idx = 0;
 
 		/* read next lines */
 		buffered_reader_read_lines(chunk->br, chunk->larr);
 
-		/* no more lines */
+		/* no more lines (or not even one line could be added) */
 		if (chunk->larr->size == 0) {
 			chunk->current_line.value = NULL;
-			return;
+			if (!chunk->larr->full)
+				return 0;
+
+			xerror("Can't allocate run lines\n");
+			return -1;
 		}
 	}
 
 	/* peek line */
 	memcpy(&chunk->current_line, &chunk->larr->lines[chunk->larr_idx++], sizeof(struct line));
+
+	/* check order */
+	if (chunk->check && chunk->last_key_len >= 0) {
+		last.key = chunk->last_key;
+		last.key_len = chunk->last_key_len;
+		if (line_compare(&last, &chunk->current_line) > 0) {
+			xerror("Input is not sorted\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Get forecast line of a chunk (last complete line read, in read ahead blocks or in chunk buffer).
+ * 
+ * @param chunk 		chunk
+ * @param line			forecast line (output)
+ *
+ * @return status (-1 if chunk can't be read ahead)
+ */
+static int __chunk_forecast(struct chunk *chunk, struct line *line)
+{
+	char *tail, *end, *start;
+	size_t tail_len;
+
+	/* in memory chunk, end of chunk or read in flight */
+	if (!chunk->tmp || !chunk->br || !chunk->current_line.value || tmp_file_forecast(chunk->tmp, &tail, &tail_len))
+		return -1;
+
+	/* last complete line of read ahead blocks (binary records boundaries are unknown in blocks) */
+	if (tail_len > 0 && !line_get_record_size()) {
+		end = memrchr(tail, '\n', tail_len);
+		start = end ? memrchr(tail, '\n', end - tail) : NULL;
+		if (start) {
+			line_init_record(line, start + 1, end - start, chunk->br->field_delim, chunk->br->key_field);
+			return 0;
+		}
+	}
+
+	/* else last line of chunk buffer */
+	memcpy(line, &chunk->larr->lines[chunk->larr->size - 1], sizeof(struct line));
+	return 0;
+}
+
+/**
+ * @brief Read ahead chunks whose buffers end with the smallest keys (forecasting), while spare blocks are available.
+ * 
+ * @param chunks 		chunks
+ */
+void chunk_prefetch(struct chunk *chunks)
+{
+	struct line line, min_line;
+	struct chunk *chunk, *min;
+
+	/* handle completed reads (their chunks can be read ahead again) */
+	tmp_file_poll();
+
+	/* the chunk whose buffer ends with the smallest key will be exhausted first */
+	do {
+		min = NULL;
+		for (chunk = chunks; chunk != NULL; chunk = chunk->next) {
+			if (__chunk_forecast(chunk, &line))
+				continue;
+
+			if (!min || line_compare(&line, &min_line) < 0) {
+				min = chunk;
+				memcpy(&min_line, &line, sizeof(struct line));
+			}
+		}
+	} while (min && !tmp_file_prefetch(min->tmp));
+
+	/* submit reads in batch */
+	tmp_file_submit();
 }
 
 /**
@@ -174,4 +449,130 @@ struct chunk *chunk_min_line(struct chunk *chunks)
 	}
 
 	return min;
+}
+
+/**
+ * @brief Split merge memory : in memory chunks keep their lines, half of what is left is a read ahead pool
+ * shared by spilled runs (asynchronous reads) and the rest is split between spilled runs buffers.
+ * 
+ * @param lists 		chunks lists (merged at the same time)
+ * @param nr_lists		number of chunks lists
+ * @param memory_size		memory size
+ *
+ * @return spilled run buffer memory size
+ */
+ssize_t chunk_merge_memory(struct chunk **lists, size_t nr_lists, ssize_t memory_size)
+{
+	struct chunk *chunk;
+	size_t nr_chunks = 0, i;
+
+	/* get number of on disk chunks and memory left by in memory chunks */
+	for (i = 0; i < nr_lists; i++) {
+		for (chunk = lists[i]; chunk != NULL; chunk = chunk->next) {
+			if (chunk->fp)
+				nr_chunks++;
+			else
+				memory_size -= chunk_memory_size(chunk);
+		}
+	}
+
+	/* nothing is read from disk */
+	if (!nr_chunks)
+		return 0;
+
+	/* runs buffers get what read ahead or direct reads buffers leave (at least their first lines) */
+	memory_size -= tmp_file_set_read_memory(memory_size / 2, nr_chunks);
+	return memory_size > (ssize_t) nr_chunks ? memory_size / (ssize_t) nr_chunks : 1;
+}
+
+/**
+ * @brief Prepare a merge of a list of chunks (first lines are peeked and read ahead starts).
+ * 
+ * @param chunks 		chunks
+ * @param field_delim 		field delimiter
+ * @param key_field 		key field
+ * @param run_memory_size	spilled run buffer memory size
+ *
+ * @return status
+ */
+int chunk_merge_prepare(struct chunk *chunks, char field_delim, int key_field, ssize_t run_memory_size)
+{
+	struct chunk *chunk;
+
+	/* prepare read */
+	for (chunk = chunks; chunk != NULL; chunk = chunk->next)
+		if (chunk_prepare_read(chunk, field_delim, key_field, run_memory_size))
+			return -1;
+
+	/* start read ahead */
+	chunk_prefetch(chunks);
+
+	return 0;
+}
+
+/**
+ * @brief Consume current line of a merged chunk (its current line is invalidated).
+ * 
+ * @param chunks 		merged chunks
+ * @param chunk 		chunk holding the minimum line
+ *
+ * @return status (-1 if chunk is not sorted or its lines can't be allocated)
+ */
+int chunk_merge_next(struct chunk *chunks, struct chunk *chunk)
+{
+	/* peek a line from min chunk */
+	if (chunk_peek_line(chunk))
+		return -1;
+
+	/* chunk is exhausted */
+	if (!chunk->current_line.value)
+		progress_add(PROGRESS_RUNS_MERGED, 1);
+
+	/* min chunk buffer was refilled (read ahead blocks were consumed) : read ahead next chunks */
+	if (chunk->larr_idx == 1)
+		chunk_prefetch(chunks);
+
+	return 0;
+}
+
+/**
+ * @brief Merge a list of chunks (spilled runs are read ahead, in memory chunks are read in place).
+ * 
+ * @param chunks 		chunks
+ * @param field_delim 		field delimiter
+ * @param key_field 		key field
+ * @param memory_size		memory size
+ * @param limit			number of lines to output (0 = all lines)
+ * @param output		output callback, called for each line in sorted order (non zero return stops the merge)
+ * @param arg			output callback argument
+ *
+ * @return status
+ */
+int chunk_merge(struct chunk *chunks, char field_delim, int key_field, ssize_t memory_size, size_t limit,
+		int (*output)(struct line *line, void *arg), void *arg)
+{
+	struct chunk *chunk;
+	size_t nr_lines;
+
+	/* prepare merge */
+	if (chunk_merge_prepare(chunks, field_delim, key_field, chunk_merge_memory(&chunks, 1, memory_size)))
+		return -1;
+
+	/* merge chunks */
+	for (nr_lines = 0; !limit || nr_lines < limit; nr_lines++) {
+		/* compute min line */
+		chunk = chunk_min_line(chunks);
+		if (!chunk)
+			break;
+
+		/* output line */
+		if (output(&chunk->current_line, arg))
+			return -1;
+
+		/* go to next line */
+		if (chunk_merge_next(chunks, chunk))
+			return -1;
+	}
+
+	return 0;
 }
\ No newline at end of file
@@ -2,16 +2,23 @@
 #define _CHUNK_H_
 
 #include "buffered_reader.h"
+#include "tmp_file.h"
 
 /**
  * @brief Chunk.
  */
 struct chunk {
 	FILE *				fp;
+	struct tmp_file *		tmp;
+	char *				buf;
 	struct line_array *		larr;
 	struct buffered_reader *	br;
 	size_t				larr_idx;
 	struct line 			current_line;
+	char				check;
+	char *				last_key;
+	int				last_key_len;
+	size_t				last_key_capacity;
 	struct chunk *			next;
 };
 
@@ -20,7 +27,7 @@ struct chunk {
  *
  * @param capacity	capacity
  * 
- * @return chunk
+ * @return chunk (NULL if memory can't be allocated)
  */
 struct chunk *chunk_create(size_t capacity);
 
@@ -31,6 +38,13 @@ struct chunk *chunk_create(size_t capacity);
  */
 void chunk_free(struct chunk *chunk);
 
+/**
+ * @brief Free a list of chunks.
+ * 
+ * @param chunks 	chunks
+ */
+void chunk_free_list(struct chunk *chunks);
+
 /**
  * @brief Clear a chunk (free lines).
  * 
@@ -43,10 +57,32 @@ void chunk_clear_full(struct chunk *chunk);
  * 
  * @param chunk 		chunk
  * @param nr_threads		number of threads to use
+ * @param path			run file path (NULL = anonymous temporary file)
  *
  * @return status
  */
-int chunk_sort_write(struct chunk *chunk, size_t nr_threads);
+int chunk_sort_write(struct chunk *chunk, size_t nr_threads, const char *path);
+
+/**
+ * @brief Sort a chunk and keep it in memory (instead of writing it on disk).
+ * 
+ * @param chunk 		chunk
+ * @param br			buffered reader holding chunk lines
+ * @param steal			steal reader buffer (else lines are compacted in a new buffer) ?
+ * @param nr_threads		number of threads to use
+ *
+ * @return status (-1 if compacted lines can't be allocated : chunk is sorted but must be written)
+ */
+int chunk_sort_keep(struct chunk *chunk, struct buffered_reader *br, int steal, size_t nr_threads);
+
+/**
+ * @brief Get memory used by an in memory chunk.
+ * 
+ * @param chunk 		chunk
+ *
+ * @return memory size
+ */
+size_t chunk_memory_size(struct chunk *chunk);
 
 /**
  * @brief Prepare chunk read.
@@ -55,15 +91,26 @@ int chunk_sort_write(struct chunk *chunk, size_t nr_threads);
  * @param field_delim 		field delimiter
  * @param key_field 		key field
  * @param memory_size		memory size
+ *
+ * @return status
  */
-void chunk_prepare_read(struct chunk *chunk, char field_delim, int key_field, ssize_t memory_size);
+int chunk_prepare_read(struct chunk *chunk, char field_delim, int key_field, ssize_t memory_size);
 
 /**
  * @brief Peek a line from a chunk.
  * 
  * @param chunk 		chunk
+ *
+ * @return status (-1 if chunk is not sorted or its lines can't be allocated)
+ */
+int chunk_peek_line(struct chunk *chunk);
+
+/**
+ * @brief Read ahead chunks whose buffers end with the smallest keys (forecasting), while spare blocks are available.
+ * 
+ * @param chunks 		chunks
  */
-void chunk_peek_line(struct chunk *chunk);
+void chunk_prefetch(struct chunk *chunks);
 
 /**
  * @brief Get minimum line from a list of chunks.
@@ -74,4 +121,54 @@ void chunk_peek_line(struct chunk *chunk);
  */
 struct chunk *chunk_min_line(struct chunk *chunks);
 
+/**
+ * @brief Split merge memory : in memory chunks keep their lines, half of what is left is a read ahead pool
+ * shared by spilled runs (asynchronous reads) and the rest is split between spilled runs buffers.
+ * 
+ * @param lists 		chunks lists (merged at the same time)
+ * @param nr_lists		number of chunks lists
+ * @param memory_size		memory size
+ *
+ * @return spilled run buffer memory size
+ */
+ssize_t chunk_merge_memory(struct chunk **lists, size_t nr_lists, ssize_t memory_size);
+
+/**
+ * @brief Prepare a merge of a list of chunks (first lines are peeked and read ahead starts).
+ * 
+ * @param chunks 		chunks
+ * @param field_delim 		field delimiter
+ * @param key_field 		key field
+ * @param run_memory_size	spilled run buffer memory size
+ *
+ * @return status
+ */
+int chunk_merge_prepare(struct chunk *chunks, char field_delim, int key_field, ssize_t run_memory_size);
+
+/**
+ * @brief Consume current line of a merged chunk (its current line is invalidated).
+ * 
+ * @param chunks 		merged chunks
+ * @param chunk 		chunk holding the minimum line
+ *
+ * @return status (-1 if chunk is not sorted or its lines can't be allocated)
+ */
+int chunk_merge_next(struct chunk *chunks, struct chunk *chunk);
+
+/**
+ * @brief Merge a list of chunks (spilled runs are read ahead, in memory chunks are read in place).
+ * 
+ * @param chunks 		chunks
+ * @param field_delim 		field delimiter
+ * @param key_field 		key field
+ * @param memory_size		memory size
+ * @param limit			number of lines to output (0 = all lines)
+ * @param output		output callback, called for each line in sorted order (non zero return stops the merge)
+ * @param arg			output callback argument
+ *
+ * @return status
+ */
+int chunk_merge(struct chunk *chunks, char field_delim, int key_field, ssize_t memory_size, size_t limit,
+		int (*output)(struct line *line, void *arg), void *arg);
+
 #endif
\ No newline at end of file
@@ -1,7 +1,20 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <locale.h>
+#include <malloc.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
 
 #include "chunk.h"
 #include "buffered_reader.h"
+#include "partition.h"
+#include "tmp_file.h"
+#include "manifest.h"
+#include "thread_pool.h"
+#include "numa.h"
+#include "progress.h"
 #include "mem.h"
 
 #define INPUT_FILE		"/home/eric/dev/data/test.txt"
@@ -10,79 +23,956 @@
 #define KEY_FIELD		1
 #define HEADER			1
 #define NR_THREADS		8
+#define SAMPLES_PER_PART	64
+#define MAX_MEMORY_SHRINK	4
+#define MMAP_THRESHOLD		(128 * 1024)
+#define COPY_BUF_SIZE		(1024 * 1024)
+#define PEEK_MEMORY_SIZE	(64 * 1024)
 
 /* default memory size */
 static ssize_t memory_size = (ssize_t) 512 * (ssize_t) 1024 * (ssize_t) 1024;
 
+/**
+ * @brief Keep truncated binary record at end of input in its own in memory chunk (runs are read back as fixed size records).
+ * 
+ * @param chunk			last chunk of input
+ * @param tail_len		truncated record length (output, 0 = no truncated record)
+ *
+ * @return status
+ */
+static int __keep_truncated_record(struct chunk *chunk, size_t *tail_len)
+{
+	struct line_array *larr = chunk->larr;
+	struct chunk *tail;
+	size_t len;
+
+	/* truncated record is the last one read */
+	len = larr->lines[larr->size - 1].value_len;
+	if (len >= line_get_record_size())
+		return 0;
+
+	/* move it to a new chunk, after last chunk */
+	tail = chunk_create(1);
+	if (!tail) {
+		fprintf(stderr, "Can't allocate lines\n");
+		return -1;
+	}
+
+	line_array_add_line(tail->larr, &larr->lines[--larr->size]);
+	if (chunk_sort_keep(tail, NULL, 0, 1)) {
+		fprintf(stderr, "Can't allocate lines\n");
+		chunk_free(tail);
+		return -1;
+	}
+
+	tail->next = chunk->next;
+	chunk->next = tail;
+
+	*tail_len = len;
+	return 0;
+}
+
 /**
  * @brief Divide and sort a file.
  * 
- * @param input_file		input file
- * @param fp_out		output file
+ * @param br			input buffered reader
+ * @param head			runs already spilled (resumed sort)
+ * @param memory_size		memory size
+ * @param nr_threads		number of threads to use
+ * @param limit			number of lines to keep per chunk (0 = all lines)
+ * @param sample		keys sample (to compute partitions splitters, may be NULL)
+ * @param sample_step		sampling step
+ * @param manifest		resumable sort manifest (runs are named files recorded in it, may be NULL)
+ * @param min_line		copy of smallest line (output, NULL = not needed)
+ *
+ * @return chunks (last chunk may be kept in memory)
+ */
+static struct chunk *__divide_and_sort(struct buffered_reader *br, struct chunk *head, ssize_t memory_size, size_t nr_threads, size_t limit,
+				       struct line_array *sample, size_t sample_step, struct manifest *manifest, struct line *min_line)
+{
+	size_t len, i, max_memory, tail_len = 0, bytes_read = 0;
+	struct chunk *chunk;
+	char path[4096];
+	ssize_t avail;
+	int ret, last;
+
+	progress_set_phase(PROGRESS_READ);
+
+	/* divide and sort */
+	for (;;) {
+		/* lines index and sort keys get memory left by reader buffer (and by memory cgroup) */
+		max_memory = (size_t) memory_size > br->buf_capacity ? memory_size - br->buf_capacity : sizeof(struct line);
+		avail = mem_available();
+		if (avail >= 0 && (size_t) avail < max_memory)
+			max_memory = (size_t) avail > max_memory / MAX_MEMORY_SHRINK ? (size_t) avail : max_memory / MAX_MEMORY_SHRINK;
+
+		/* create a new chunk (line length estimate may be wrong : lines array grows in its memory budget, then chunk is spilled early) */
+		len = br->buf_capacity / br->line_len + 1;
+		chunk = chunk_create(len < max_memory / sizeof(struct line) ? len : max_memory / sizeof(struct line));
+		if (!chunk) {
+			fprintf(stderr, "Can't allocate lines\n");
+			goto err;
+		}
+
+		chunk->larr->grow_slow = 0;
+		chunk->larr->max_memory = max_memory;
+
+		/* read chunk */
+		buffered_reader_read_lines(br, chunk->larr);
+
+		/* tags don't point in reader buffer : read until they fill memory left by reader */
+		while (br->tags && !feof(br->fp) && !chunk->larr->full) {
+			len = chunk->larr->size;
+			buffered_reader_read_lines(br, chunk->larr);
+			if (chunk->larr->size == len)
+				break;
+		}
+
+		progress_add(PROGRESS_BYTES_READ, br->bytes_read - bytes_read);
+		bytes_read = br->bytes_read;
+
+		if (chunk->larr->size == 0) {
+			chunk_free(chunk);
+			if (br->off > 0 && !feof(br->fp)) {
+				fprintf(stderr, "Can't allocate lines\n");
+				goto err;
+			}
+
+			goto out;
+		}
+
+		/* add chunk to list */
+		chunk->next = head;
+		head = chunk;
+
+		/* truncated binary record can't be spilled with other runs */
+		if (line_get_record_size() && !br->tags && feof(br->fp) && !chunk->larr->full && chunk->next && chunk->larr->size > 1)
+			if (__keep_truncated_record(chunk, &tail_len))
+				goto err;
+
+		/* only first lines of a chunk can be output */
+		if (limit)
+			line_array_limit(chunk->larr, limit, nr_threads);
+
+		/* last chunk : keep it in memory (single run = whole reader buffer, else compacted if it leaves enough memory to merge other runs) */
+		last = feof(br->fp) && !chunk->larr->full && !chunk->next;
+		if (!last && feof(br->fp) && !chunk->larr->full) {
+			for (i = 0, len = chunk->larr->size * sizeof(struct line); i < chunk->larr->size; i++)
+				len += chunk->larr->lines[i].value_len;
+			last = len <= (size_t) memory_size / 2;
+		}
+
+		/* sort and keep or write chunk */
+		if (last) {
+			/* compacted copy of last chunk may not fit in memory : write it (already sorted) */
+			if (chunk_sort_keep(chunk, br, !chunk->next && !br->tags, nr_threads)) {
+				ret = chunk_sort_write(chunk, nr_threads, NULL);
+				if (ret)
+					goto err;
+				progress_add(PROGRESS_CHUNKS_SPILLED, 1);
+			}
+		} else if (manifest) {
+			/* resumable sort : record run (and input offset after it) once written */
+			manifest_run_path(manifest, manifest->nr_runs, path, sizeof(path));
+			ret = chunk_sort_write(chunk, nr_threads, path);
+			if (!ret)
+				ret = manifest_add_run(manifest, buffered_reader_tell(br) - tail_len, chunk->larr->size);
+			if (ret)
+				goto err;
+			progress_add(PROGRESS_CHUNKS_SPILLED, 1);
+		} else {
+			ret = chunk_sort_write(chunk, nr_threads, NULL);
+			if (ret)
+				goto err;
+			progress_add(PROGRESS_CHUNKS_SPILLED, 1);
+		}
+
+		/* sample sorted chunk */
+		if (sample && partition_add_sample(sample, chunk->larr, sample_step)) {
+			fprintf(stderr, "Can't allocate sample\n");
+			goto err;
+		}
+
+		/* keep smallest line (first line of a sorted chunk) */
+		if (min_line && (!min_line->value || line_compare(&chunk->larr->lines[0], min_line) < 0)) {
+			xfree(min_line->value);
+			if (line_dup(min_line, &chunk->larr->lines[0])) {
+				fprintf(stderr, "Can't allocate line\n");
+				goto err;
+			}
+		}
+
+		/* last chunk : done (lines of a written one are not needed anymore) */
+		if (last) {
+			if (chunk->fp)
+				chunk_clear_full(chunk);
+			goto out;
+		}
+
+		/* chunk was spilled early : give reader memory back to lines (tags don't point in reader buffer) */
+		if (chunk->larr->full && !br->tags)
+			buffered_reader_rebalance(br, chunk->larr, memory_size);
+
+		/* clear chunk */
+		chunk_clear_full(chunk);
+	}
+
+err:
+	/* free chunks */
+	chunk_free_list(head);
+
+	head = NULL;
+out:
+	return head;
+}
+
+/**
+ * @brief Keep first lines of a file in a bounded heap and write them (nothing is spilled on disk).
+ * 
+ * @param br			input buffered reader
+ * @param fp_out		output file
+ * @param nr_threads		number of threads to use
+ * @param limit			number of lines to output
+ *
+ * @return status
+ */
+static int __top_lines(struct buffered_reader *br, FILE *fp_out, size_t nr_threads, size_t limit)
+{
+	struct line_array *larr, *heap;
+	struct line line;
+	size_t i;
+	int ret;
+
+	/* create lines array and heap */
+	larr = line_array_create(br->buf_capacity / br->line_len + 1, 1);
+	heap = line_array_create(limit, 1);
+	if (!larr || !heap) {
+		fprintf(stderr, "Can't allocate lines\n");
+		line_array_free(heap);
+		line_array_free(larr);
+		return -1;
+	}
+
+	for (;;) {
+		/* read next lines */
+		larr->size = 0;
+		buffered_reader_read_lines(br, larr);
+		if (larr->size == 0)
+			break;
+
+		for (i = 0; i < larr->size; i++) {
+			/* line can't make the cut */
+			if (heap->size == limit && line_compare(&larr->lines[i], &heap->lines[0]) >= 0)
+				continue;
+
+			/* copy line (reader buffer is reused) */
+			if (line_dup(&line, &larr->lines[i])) {
+				fprintf(stderr, "Can't allocate line\n");
+				ret = -1;
+				goto out;
+			}
+
+			/* add line to heap */
+			if (heap->size < limit) {
+				line_heap_push(heap, &line);
+			} else {
+				xfree(heap->lines[0].value);
+				line_heap_replace_top(heap, &line);
+			}
+		}
+	}
+
+	/* sort and write lines */
+	line_array_sort(heap, nr_threads);
+	ret = line_array_write(heap, fp_out);
+out:
+	/* free lines */
+	for (i = 0; i < heap->size; i++)
+		xfree(heap->lines[i].value);
+	line_array_free(heap);
+	line_array_free(larr);
+
+	return ret;
+}
+
+/**
+ * @brief Open runs recorded in a manifest as chunks (resumed sort).
+ * 
+ * @param manifest		resumable sort manifest
+ * @param chunks		chunks (output)
+ *
+ * @return status
+ */
+static int __resume_runs(struct manifest *manifest, struct chunk **chunks)
+{
+	struct chunk *chunk;
+	char path[4096];
+	size_t i;
+
+	for (i = 0; i < manifest->nr_runs; i++) {
+		/* create a new chunk */
+		chunk = chunk_create(0);
+		if (!chunk) {
+			fprintf(stderr, "Can't allocate run\n");
+			return -1;
+		}
+
+		chunk->next = *chunks;
+		*chunks = chunk;
+
+		/* open run */
+		manifest_run_path(manifest, i, path, sizeof(path));
+		chunk->fp = tmp_file_open(path, &chunk->tmp);
+		if (!chunk->fp) {
+			fprintf(stderr, "Can't open run \"%s\"\n", path);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Get smallest first line of resumed runs (runs are rewound for the merge).
+ * 
+ * @param chunks		resumed runs
+ * @param field_delim		field delimiter
+ * @param key_field		key field
+ * @param min_line		copy of smallest line (output)
+ *
+ * @return status
+ */
+static int __resumed_min_line(struct chunk *chunks, char field_delim, int key_field, struct line *min_line)
+{
+	struct chunk *chunk;
+
+	for (chunk = chunks; chunk != NULL; chunk = chunk->next) {
+		/* peek first line (small reader : lines are read again during the merge) */
+		if (chunk_prepare_read(chunk, field_delim, key_field, PEEK_MEMORY_SIZE))
+			goto err;
+
+		if (chunk->current_line.value && (!min_line->value || line_compare(&chunk->current_line, min_line) < 0)) {
+			xfree(min_line->value);
+			if (line_dup(min_line, &chunk->current_line))
+				goto err;
+		}
+
+		/* rewind run */
+		buffered_reader_free(chunk->br);
+		chunk->br = NULL;
+		chunk_clear_full(chunk);
+		if (fseeko(chunk->fp, 0, SEEK_SET))
+			goto err;
+	}
+
+	return 0;
+err:
+	fprintf(stderr, "Can't read run\n");
+	return -1;
+}
+
+/**
+ * @brief Open already sorted input files as chunks (runs).
+ * 
+ * @param input_files		input files ("-" for standard input)
+ * @param nr_input_files	number of input files
+ * @param fp_out		output file (first input header is written in it, NULL = headers are skipped)
+ * @param header		number of header lines
+ * @param check			check input files are sorted ?
+ *
+ * @return chunks
+ */
+static struct chunk *__open_runs(char **input_files, size_t nr_input_files, FILE *fp_out, size_t header, char check)
+{
+	struct chunk *head = NULL, *chunk;
+	char *line = NULL;
+	size_t len = 0, i, j;
+
+	for (i = 0; i < nr_input_files; i++) {
+		/* create a new chunk */
+		chunk = chunk_create(0);
+		if (!chunk) {
+			fprintf(stderr, "Can't allocate run\n");
+			goto err;
+		}
+
+		chunk->check = check;
+
+		/* add chunk to list */
+		chunk->next = head;
+		head = chunk;
+
+		/* open input file */
+		chunk->fp = strcmp(input_files[i], "-") ? fopen(input_files[i], "r") : stdin;
+		if (!chunk->fp) {
+			fprintf(stderr, "Can't open input file \"%s\"\n", input_files[i]);
+			goto err;
+		}
+
+		/* skip header (write first input header) */
+		for (j = 0; j < header; j++) {
+			if (getline(&line, &len, chunk->fp) == -1)
+				break;
+
+			if (i == 0 && fp_out)
+				fputs(line, fp_out);
+		}
+	}
+
+	goto out;
+err:
+	/* free chunks */
+	chunk_free_list(head);
+	head = NULL;
+out:
+	/* free line */
+	xfree(line);
+
+	return head;
+}
+
+/**
+ * @brief Read a line of base file (incremental merge).
+ * 
+ * @param fp			base file
+ * @param off			line offset
+ * @param buf			line buffer (reallocated)
+ * @param capacity		line buffer capacity
+ * @param field_delim		field delimiter
+ * @param key_field		key field
+ * @param larr			line array (gets the line and its sort key)
+ *
+ * @return offset of next line (-1 on error or at end of file)
+ */
+static off_t __read_base_line(FILE *fp, off_t off, char **buf, size_t *capacity, char field_delim, int key_field, struct line_array *larr)
+{
+	size_t record_size = line_get_record_size();
+	ssize_t len;
+	char *s;
+
+	if (fseeko(fp, off, SEEK_SET))
+		return -1;
+
+	/* binary record or text line */
+	if (record_size) {
+		if (*capacity < record_size) {
+			s = (char *) realloc(*buf, record_size);
+			if (!s)
+				return -1;
+
+			*buf = s;
+			*capacity = record_size;
+		}
+		len = fread(*buf, 1, record_size, fp);
+	} else {
+		len = getline(buf, capacity, fp);
+	}
+
+	if (len <= 0)
+		return -1;
+
+	/* compute key (as sorted lines do) */
+	larr->size = 0;
+	larr->keys_len = 0;
+	if (line_array_add(larr, *buf, len, field_delim, key_field))
+		return -1;
+
+	return off + len;
+}
+
+/**
+ * @brief Find first line of a sorted base file not smaller than a line (binary search on offsets, lines are resynchronized
+ * on next newline or record boundary).
+ * 
+ * @param fp			base file
+ * @param start			offset of first line (after header)
+ * @param end			base file size
+ * @param min_line		line
+ * @param field_delim		field delimiter
+ * @param key_field		key field
+ *
+ * @return offset of first line not smaller than min_line (-1 on error)
+ */
+static off_t __find_base_line(FILE *fp, off_t start, off_t end, struct line *min_line, char field_delim, int key_field)
+{
+	size_t record_size = line_get_record_size(), capacity = 0;
+	off_t lo = start, hi = end, mid, pos, next;
+	struct line_array *larr;
+	char *buf = NULL;
+	int c;
+
+	larr = line_array_create(1, 0);
+	if (!larr)
+		return -1;
+
+	/* lines before lo are smaller than min_line, line at hi is not (or hi is end of file) */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		/* first line starting at or after mid */
+		if (record_size) {
+			pos = start + (mid - start + record_size - 1) / record_size * record_size;
+		} else if (mid == lo) {
+			pos = lo;
+		} else {
+			if (fseeko(fp, mid - 1, SEEK_SET))
+				goto err;
+			for (pos = mid - 1; pos < hi && (c = getc(fp)) != EOF && c != '\n'; pos++)
+				;
+			pos++;
+		}
+
+		/* no line starts in [mid, hi) : check line at lo */
+		if (pos >= hi)
+			pos = lo;
+
+		next = __read_base_line(fp, pos, &buf, &capacity, field_delim, key_field, larr);
+		if (next < 0)
+			goto err;
+
+		if (line_compare(&larr->lines[0], min_line) < 0)
+			lo = next;
+		else
+			hi = pos;
+	}
+
+	xfree(buf);
+	line_array_free(larr);
+	return lo;
+err:
+	xfree(buf);
+	line_array_free(larr);
+	return -1;
+}
+
+/**
+ * @brief Copy a range of base file in output file (in kernel if file systems allow it).
+ * 
+ * @param fp			base file
+ * @param off			range offset
+ * @param len			range length
+ * @param fp_out		output file
+ *
+ * @return status
+ */
+static int __copy_base_range(FILE *fp, off_t off, off_t len, FILE *fp_out)
+{
+	char *buf = NULL;
+	ssize_t n;
+	int ret = -1;
+
+	if (fflush(fp_out))
+		return -1;
+
+	/* copy_file_range (no user space copy, extents may be shared) */
+	while (len > 0 && (n = copy_file_range(fileno(fp), &off, fileno(fp_out), NULL, len, 0)) > 0)
+		len -= n;
+
+	/* not supported (pipe, cross file system on old kernels...) : read and write */
+	if (len > 0) {
+		buf = (char *) malloc(COPY_BUF_SIZE);
+		if (!buf)
+			return -1;
+
+		while (len > 0) {
+			n = pread(fileno(fp), buf, len < COPY_BUF_SIZE ? len : COPY_BUF_SIZE, off);
+			if (n <= 0 || fwrite(buf, 1, n, fp_out) != (size_t) n)
+				goto out;
+			off += n;
+			len -= n;
+		}
+
+		if (fflush(fp_out))
+			goto out;
+	}
+
+	ret = 0;
+out:
+	xfree(buf);
+	return ret;
+}
+
+/**
+ * @brief Copy lines of base run smaller than all new lines as is (incremental merge), so the merge only rewrites
+ * the region where new keys fall.
+ * 
+ * @param base			base run (opened, header skipped)
+ * @param min_line		smallest new line (NULL value = no new line)
+ * @param fp_out		output file (NULL = partitioned or limited output, no copy)
+ * @param field_delim		field delimiter
+ * @param key_field		key field
+ *
+ * @return status
+ */
+static int __copy_base_prefix(struct chunk *base, struct line *min_line, FILE *fp_out, char field_delim, int key_field)
+{
+	off_t start, off;
+	struct stat st;
+
+	/* quoted newlines and tags can't be resynchronized : whole base file is merged */
+	if (!min_line->value || !fp_out || (line_get_key_flags() & (LINE_KEY_CSV | LINE_KEY_TAG)))
+		return 0;
+
+	start = ftello(base->fp);
+	if (start < 0 || fstat(fileno(base->fp), &st) || !S_ISREG(st.st_mode))
+		return 0;
+
+	/* copy lines before new keys, merge from there */
+	off = __find_base_line(base->fp, start, st.st_size, min_line, field_delim, key_field);
+	if (off < 0 || (off > start && __copy_base_range(base->fp, start, off - start, fp_out)) || fseeko(base->fp, off, SEEK_SET))
+		return -1;
+
+	progress_add(PROGRESS_BYTES_OUT, off - start);
+	return 0;
+}
+
+/**
+ * @brief Remove an existing output file (devices are written in place).
+ * 
+ * @param output_file		output file ("-" for standard output)
+ */
+static void __remove_output(const char *output_file)
+{
+	struct stat st;
+
+	if (strcmp(output_file, "-") && !stat(output_file, &st) && S_ISREG(st.st_mode))
+		remove(output_file);
+}
+
+/**
+ * @brief Flush an output file and sync it to disk (if it is a regular file).
+ * 
+ * @param fp			output file
+ *
+ * @return status
+ */
+static int __sync_output(FILE *fp)
+{
+	struct stat st;
+
+	if (fflush(fp))
+		return -1;
+
+	if (!fstat(fileno(fp), &st) && S_ISREG(st.st_mode) && fsync(fileno(fp)))
+		return -1;
+
+	return 0;
+}
+
+/**
+ * @brief Merge output (single output file or range partitioned output).
+ */
+struct merge_output {
+	FILE *			fp;
+	struct partition *	part;
+	int			fd;
+	char *			buf;
+	size_t			buf_capacity;
+};
+
+/**
+ * @brief Write a merged line.
+ * 
+ * @param line			line
+ * @param arg			merge output
+ *
+ * @return status
+ */
+static int __write_line(struct line *line, void *arg)
+{
+	struct merge_output *out = (struct merge_output *) arg;
+	char *value = line->value, *buf;
+	size_t len = line->value_len;
+	FILE *fp = out->fp;
+	ssize_t n;
+	off_t off;
+
+	/* choose partition */
+	if (out->part)
+		fp = partition_output(out->part, line);
+
+	/* tag : gather line from input (last line of input may have no newline) */
+	if (out->fd >= 0) {
+		off = line_tag_parse(line, &len);
+		if (len > out->buf_capacity) {
+			buf = (char *) realloc(out->buf, len);
+			if (!buf) {
+				fprintf(stderr, "Can't allocate line\n");
+				return -1;
+			}
+
+			out->buf = buf;
+			out->buf_capacity = len;
+		}
+
+		n = pread(out->fd, out->buf, len, off);
+		if (n == (ssize_t) len - 1) {
+			out->buf[n] = '\n';
+		} else if (n != (ssize_t) len) {
+			fprintf(stderr, "Can't read input file\n");
+			return -1;
+		}
+
+		value = out->buf;
+	}
+
+	/* write line to output file */
+	if (fwrite(value, 1, len, fp) != len) {
+		fprintf(stderr, "Can't write output file\n");
+		return -1;
+	}
+
+	progress_add(PROGRESS_LINES_OUT, 1);
+	progress_add(PROGRESS_BYTES_OUT, len);
+	return 0;
+}
+
+/**
+ * @brief Merge and sort a list of chunks.
+ * 
+ * @param fp			output file
+ * @param field_delim		field delimiter
+ * @param key_field		key field
+ * @param memory_size		memory size
+ * @param limit			number of lines to output (0 = all lines)
+ * @param part			range partitioned output (NULL = single output file)
+ * @param fd			input file, lines of tags are gathered from it (-1 = plain lines)
+ * 
+ * @return status
+ */
+static int __merge_sort(FILE *fp, struct chunk *chunks, char field_delim, int key_field, ssize_t memory_size, size_t limit, struct partition *part,
+			int fd)
+{
+	struct merge_output out = { fp, part, fd, NULL, 0 };
+	struct chunk *chunk;
+	int ret;
+
+	/* merge phase */
+	progress_set_phase(PROGRESS_MERGE);
+	for (chunk = chunks; chunk != NULL; chunk = chunk->next)
+		progress_add(PROGRESS_RUNS, 1);
+
+	ret = chunk_merge(chunks, field_delim, key_field, memory_size, limit, __write_line, &out);
+	xfree(out.buf);
+
+	return ret;
+}
+
+/**
+ * @brief Sort a file.
+ * 
+ * @param input_file 		input file ("-" for standard input)
+ * @param output_file 		output file ("-" for standard output)
  * @param memory_size		memory size
- * @param field_delim		field delimiter
- * @param key_field		key field
- * @param header		number of header lines
+ * @param field_delim 		field delimiter
+ * @param key_field 		key field
+ * @param header 		number of header lines
  * @param nr_threads		number of threads to use
+ * @param limit			number of lines to output (0 = all lines)
+ * @param nr_parts		number of range partitioned output files (0 = single output file)
+ * @param splitters		partitions splitters keys (NULL = sampled quantiles)
+ * @param work_dir		resumable sort work directory (NULL = runs are anonymous temporary files)
+ * @param base_file		already sorted base file merged with sorted input as an extra run (NULL = no base file)
  *
- * @return chunks
+ * @return status
  */
-static struct chunk *__divide_and_sort(const char *input_file, FILE *fp_out, ssize_t memory_size, char field_delim, int key_field, size_t header, size_t nr_threads)
+static int sort(const char *input_file, const char *output_file, ssize_t memory_size, char field_delim, int key_field, size_t header, size_t nr_threads,
+		size_t limit, size_t nr_parts, const char *splitters, const char *work_dir, const char *base_file)
 {
-	struct chunk *head = NULL, *chunk;
+	struct line_array *sample = NULL;
 	struct buffered_reader *br = NULL;
-	FILE *fp_in = NULL;
-	size_t i;
-	int ret;
+	struct manifest *manifest = NULL;
+	struct partition *part = NULL;
+	struct chunk *chunks = NULL, *base = NULL;
+	int tags = line_get_key_flags() & LINE_KEY_TAG;
+	FILE *fp_in = NULL, *fp_out = NULL;
+	size_t i, nr_keys, sample_step = 0, key_off, key_len, base_size = 0;
+	struct line *keys, min_line = { NULL, 0, NULL, 0 };
+	char input_id[4096 + 160];
+	struct stat st, st_base;
+	int ret = -1;
+
+	/* incremental merge : base file is read while output is written */
+	if (base_file) {
+		if (stat(base_file, &st_base)) {
+			fprintf(stderr, "Can't open base file \"%s\"\n", base_file);
+			goto out;
+		}
+
+		if (!nr_parts && strcmp(output_file, "-") && !stat(output_file, &st) && st.st_dev == st_base.st_dev && st.st_ino == st_base.st_ino) {
+			fprintf(stderr, "Can't write output in base file \"%s\"\n", base_file);
+			goto out;
+		}
+
+		base_size = st_base.st_size;
+	}
 
 	/* open input file */
-	fp_in = fopen(input_file, "r");
+	fp_in = strcmp(input_file, "-") ? fopen(input_file, "r") : stdin;
 	if (!fp_in) {
 		fprintf(stderr, "Can't open input file \"%s\"\n", input_file);
-		goto err;
+		goto out;
+	}
+
+	/* resumable sort : reopen runs recorded by a previous sort of the same input with the same options */
+	if (work_dir) {
+		if (fstat(fileno(fp_in), &st)) {
+			fprintf(stderr, "Can't stat input file\n");
+			goto out;
+		}
+
+		/* runs depend on input and on every option changing lines, keys or their order */
+		line_get_record_key(&key_off, &key_len);
+		snprintf(input_id, sizeof(input_id), "%lld %lld.%09ld %d %d %d %zu %zu %zu,%zu,%zu %s", (long long) st.st_size, (long long) st.st_mtim.tv_sec,
+			 st.st_mtim.tv_nsec, line_get_key_flags(), field_delim, key_field, header, limit, line_get_record_size(), key_off, key_len, input_file);
+		manifest = manifest_open(work_dir, input_id);
+		if (!manifest || __resume_runs(manifest, &chunks))
+			goto out;
+
+		/* incremental merge : base lines can only be copied up to smallest line of all runs */
+		if (base_file && __resumed_min_line(chunks, field_delim, key_field, &min_line))
+			goto out;
 	}
 
-	/* create buffered reader */
-	br = buffered_reader_create(fp_in, field_delim, key_field, header, memory_size);
+	/* create buffered reader (tags : reader buffer is reused, most memory is left to tags) */
+	br = buffered_reader_create(fp_in, field_delim, key_field, header, tags ? memory_size / 4 : memory_size);
 	if (!br)
-		goto err;
+		goto out;
 
-	/* write header */
-	for (i = 0; i < br->nr_header_lines; i++)
-		fputs(br->header_lines[i], fp_out);
+	/* tags : lines are gathered from input in output order */
+	br->tags = tags;
 
-	/* divide and sort */
-	for (;;) {
-		/* create a new chunk */
-		chunk = chunk_create(memory_size / br->line_len);
+	/* resumed sort : continue after last recorded run */
+	if (manifest && manifest->input_off && buffered_reader_seek(br, manifest->input_off)) {
+		fprintf(stderr, "Can't seek input file\n");
+		goto out;
+	}
 
-		/* read chunk */
-		buffered_reader_read_lines(br, chunk->larr);
-		if (chunk->larr->size == 0) {
-			chunk_free(chunk);
+	/* progress : input left to read, then whole input to write */
+	if (!fstat(fileno(fp_in), &st) && S_ISREG(st.st_mode))
+		progress_set_work(st.st_size - (manifest ? manifest->input_off : 0), st.st_size + base_size);
+
+	if (nr_parts) {
+		/* open partitioned output files */
+		part = partition_create(output_file, nr_parts);
+		if (!part)
 			goto out;
+
+		/* set splitters or sample chunks to compute them */
+		if (splitters) {
+			nr_keys = partition_parse_splitters(splitters, &keys);
+			if (!nr_keys) {
+				fprintf(stderr, "Can't allocate splitters\n");
+				goto out;
+			}
+
+			partition_set_splitters(part, keys, nr_keys);
+		} else {
+			sample = line_array_create(0, 0);
+			if (!sample) {
+				fprintf(stderr, "Can't allocate sample\n");
+				goto out;
+			}
+
+			sample_step = br->buf_capacity / br->line_len / (nr_parts * SAMPLES_PER_PART);
+			if (sample_step < 1)
+				sample_step = 1;
 		}
 
-		/* add chunk to list */
-		chunk->next = head;
-		head = chunk;
+		/* write header */
+		partition_write_header(part, br->header_lines, br->nr_header_lines);
+	} else {
+		/* remove output file */
+		__remove_output(output_file);
 
-		/* sort and write chunk */
-		ret = chunk_sort_write(chunk, nr_threads);
-		if (ret)
-			goto err;
+		/* open output file */
+		fp_out = strcmp(output_file, "-") ? fopen(output_file, "w") : stdout;
+		if (!fp_out) {
+			fprintf(stderr, "Can't open output file \"%s\"\n", output_file);
+			goto out;
+		}
 
-		/* clear chunk */
-		chunk_clear_full(chunk);
+		/* write header */
+		for (i = 0; i < br->nr_header_lines; i++)
+			fputs(br->header_lines[i], fp_out);
 	}
 
-err:
-	/* free chunks */
-	for (chunk = head; chunk != NULL; chunk = chunk->next)
-		chunk_free(chunk);
+	/* incremental merge : base file is an extra run (header is skipped, new chunks are not kept whole in memory) */
+	if (base_file) {
+		base = __open_runs((char **) &base_file, 1, NULL, header, 0);
+		if (!base)
+			goto out;
 
-	head = NULL;
+		base->next = chunks;
+		chunks = base;
+	}
+
+	/* first lines fit in memory : keep them in a bounded heap */
+	if (limit && !chunks && !tags && limit * (br->line_len + sizeof(struct line)) <= (size_t) memory_size) {
+		ret = __top_lines(br, fp_out, nr_threads, limit);
+		goto out;
+	}
+	
+	/* divide and sort (whole input may already be in recorded runs) */
+	if (!manifest || manifest->input_off < st.st_size) {
+		chunks = __divide_and_sort(br, chunks, memory_size, nr_threads, limit, sample, sample_step, manifest, base_file ? &min_line : NULL);
+		if (!chunks)
+			goto out;
+	}
+
+	/* incremental merge : lines of base run before new keys are copied (single output file) */
+	if (base && __copy_base_prefix(base, &min_line, part || limit ? NULL : fp_out, field_delim, key_field)) {
+		fprintf(stderr, "Can't read base file \"%s\"\n", base_file);
+		goto out;
+	}
+
+	/* free buffered reader */
+	buffered_reader_free(br);
+	br = NULL;
+
+	/* compute splitters (quantiles of sample) */
+	if (sample) {
+		line_array_sort(sample, nr_threads);
+		if (partition_sample_splitters(part, sample->lines, sample->size)) {
+			fprintf(stderr, "Can't allocate splitters\n");
+			goto out;
+		}
+	}
+
+	/* merge sort */
+	ret = __merge_sort(fp_out, chunks, field_delim, key_field, memory_size, limit, part, tags ? fileno(fp_in) : -1);
+	if (ret)
+		goto out;
+
+	/* close output (synced for a resumable sort : runs are only removed once output is on disk) */
+	if (manifest && (part ? partition_sync(part) : __sync_output(fp_out)))
+		ret = -1;
+	if (partition_free(part))
+		ret = -1;
+	if (fp_out && fclose(fp_out))
+		ret = -1;
+	part = NULL;
+	fp_out = NULL;
+	if (ret) {
+		fprintf(stderr, "Can't write output file\n");
+		goto out;
+	}
+
+	/* resumable sort is complete : remove runs */
+	if (manifest)
+		manifest_remove(manifest);
 out:
+	/* free chunks */
+	chunk_free_list(chunks);
+	xfree(min_line.value);
+
+	/* free manifest */
+	manifest_free(manifest);
+
+	/* free sample */
+	if (sample)
+		partition_free_sample(sample);
+
 	/* free buffered reader */
 	if (br)
 		buffered_reader_free(br);
@@ -91,108 +981,571 @@ out:
 	if (fp_in)
 		fclose(fp_in);
 
-	return head;
+	/* close output file (delayed write error fails the sort) */
+	if (fp_out && fclose(fp_out) && !ret) {
+		fprintf(stderr, "Can't write output file\n");
+		ret = -1;
+	}
+
+	/* close partitions */
+	if (partition_free(part))
+		ret = -1;
+
+	return ret;
 }
 
 /**
- * @brief Merge and sort a list of chunks.
+ * @brief Merge already sorted files.
  * 
- * @param fp			output file
- * @param field_delim		field delimiter
- * @param key_field		key field
+ * @param input_files 		input files ("-" for standard input)
+ * @param nr_input_files	number of input files
+ * @param output_file 		output file ("-" for standard output)
  * @param memory_size		memory size
- * 
+ * @param field_delim 		field delimiter
+ * @param key_field 		key field
+ * @param header 		number of header lines
+ * @param check			check input files are sorted ?
+ *
  * @return status
  */
-static int __merge_sort(FILE *fp, struct chunk *chunks, char field_delim, int key_field, ssize_t memory_size)
+static int merge(char **input_files, size_t nr_input_files, const char *output_file, ssize_t memory_size, char field_delim, int key_field, size_t header, char check)
 {
-	size_t nr_chunks = 0;
-	struct chunk *chunk;
-	int len;
+	struct chunk *chunks = NULL, *chunk;
+	FILE *fp_out = NULL;
+	size_t size = 0;
+	struct stat st;
+	int ret = -1;
 
-	/* get number of chunks */
-	for (chunk = chunks; chunk != NULL; chunk = chunk->next)
-		nr_chunks++;
+	/* runs are input files (no temporary file read ahead) */
+	tmp_file_set_async(0);
+
+	/* remove output file */
+	__remove_output(output_file);
+	
+	/* open output file */
+	fp_out = strcmp(output_file, "-") ? fopen(output_file, "w") : stdout;
+	if (!fp_out) {
+		fprintf(stderr, "Can't open output file \"%s\"\n", output_file);
+		goto out;
+	}
+
+	/* open runs */
+	chunks = __open_runs(input_files, nr_input_files, fp_out, header, check);
+	if (!chunks)
+		goto out;
 
-	/* prepare read */
+	/* progress : inputs are written once */
 	for (chunk = chunks; chunk != NULL; chunk = chunk->next)
-		chunk_prepare_read(chunk, field_delim, key_field, memory_size / nr_chunks);
+		if (!fstat(fileno(chunk->fp), &st) && S_ISREG(st.st_mode))
+			size += st.st_size;
+	progress_set_work(0, size);
 
-	/* merge chunks */
-	for (;;) {
-		/* compute min line */
-		chunk = chunk_min_line(chunks);
-		if (!chunk)
-			break;
+	/* merge sort */
+	ret = __merge_sort(fp_out, chunks, field_delim, key_field, memory_size, 0, NULL, -1);
+out:
+	/* free chunks */
+	chunk_free_list(chunks);
 
-		/* write line to output file */
-		len = (int) fwrite(chunk->current_line.value, 1, chunk->current_line.value_len, fp);
-		if (len != chunk->current_line.value_len)
-			return -1;
+	/* close output file (delayed write error fails the sort) */
+	if (fp_out && fclose(fp_out) && !ret) {
+		fprintf(stderr, "Can't write output file\n");
+		ret = -1;
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Write a joined line (left line, field delimiter then right line).
+ * 
+ * @param fp			output file
+ * @param left			left line
+ * @param right			right line (NULL = unmatched left line)
+ * @param field_delim		field delimiter
+ *
+ * @return status
+ */
+static int __write_joined(FILE *fp, struct line *left, struct line *right, char field_delim)
+{
+	size_t len = left->value_len;
+
+	progress_add(PROGRESS_LINES_OUT, 1);
+	progress_add(PROGRESS_BYTES_OUT, len + (right ? right->value_len : 0));
 
-		/* peek a line from min chunk */
-		chunk_peek_line(chunk);
+	/* unmatched left line */
+	if (!right) {
+		if (fwrite(left->value, 1, len, fp) != len)
+			goto err;
+		return 0;
 	}
 
+	/* left line without newline */
+	if (len > 0 && left->value[len - 1] == '\n')
+		len--;
+	if (fwrite(left->value, 1, len, fp) != len || fputc(field_delim, fp) == EOF)
+		goto err;
+
+	/* right line */
+	if (fwrite(right->value, 1, right->value_len, fp) != (size_t) right->value_len)
+		goto err;
+
 	return 0;
+err:
+	fprintf(stderr, "Can't write output file\n");
+	return -1;
 }
 
 /**
- * @brief Sort a file.
+ * @brief Free lines of a join group.
+ * 
+ * @param group			join group
+ */
+static void __clear_group(struct line_array *group)
+{
+	size_t i;
+
+	for (i = 0; i < group->size; i++)
+		xfree(group->lines[i].value);
+	group->size = 0;
+}
+
+/**
+ * @brief Join 2 lists of sorted chunks while merging them (right lines sharing a key are copied, left lines are streamed).
+ * 
+ * @param fp			output file
+ * @param left			left chunks
+ * @param right			right chunks
+ * @param field_delim		field delimiter
+ * @param left_join		output unmatched left lines (left outer join) ?
+ *
+ * @return status
+ */
+static int __merge_join(FILE *fp, struct chunk *left, struct chunk *right, char field_delim, char left_join)
+{
+	struct line_array *group;
+	struct chunk *l, *r;
+	struct line line;
+	int ret = -1;
+	size_t i;
+
+	/* create join group */
+	group = line_array_create(0, 0);
+	if (!group) {
+		fprintf(stderr, "Can't allocate join group\n");
+		return -1;
+	}
+
+	l = chunk_min_line(left);
+	r = chunk_min_line(right);
+	while (l) {
+		/* skip right lines with smaller keys */
+		while (r && line_compare(&r->current_line, &l->current_line) < 0) {
+			if (chunk_merge_next(right, r))
+				goto out;
+			r = chunk_min_line(right);
+		}
+
+		/* no right line with left key */
+		if (!r || line_compare(&r->current_line, &l->current_line) > 0) {
+			if (left_join && __write_joined(fp, &l->current_line, NULL, field_delim))
+				goto out;
+			if (chunk_merge_next(left, l))
+				goto out;
+			l = chunk_min_line(left);
+			continue;
+		}
+
+		/* copy right lines with left key (right buffers are reused while merging) */
+		__clear_group(group);
+		while (r && line_compare(&r->current_line, &l->current_line) == 0) {
+			if (line_dup(&line, &r->current_line)) {
+				fprintf(stderr, "Can't allocate line\n");
+				goto out;
+			}
+			line_array_add_line(group, &line);
+			if (chunk_merge_next(right, r))
+				goto out;
+			r = chunk_min_line(right);
+		}
+
+		/* join left lines with this key */
+		while (l && line_compare(&l->current_line, &group->lines[0]) == 0) {
+			for (i = 0; i < group->size; i++)
+				if (__write_joined(fp, &l->current_line, &group->lines[i], field_delim))
+					goto out;
+			if (chunk_merge_next(left, l))
+				goto out;
+			l = chunk_min_line(left);
+		}
+	}
+
+	ret = 0;
+out:
+	/* free join group */
+	__clear_group(group);
+	line_array_free(group);
+
+	return ret;
+}
+
+/**
+ * @brief Sort 2 files and join them on their keys while merging (sorted files are never written).
  * 
- * @param input_file 		input file
- * @param output_file 		output file
+ * @param input_file 		left input file
+ * @param join_file 		right input file
+ * @param output_file 		output file ("-" for standard output)
  * @param memory_size		memory size
  * @param field_delim 		field delimiter
  * @param key_field 		key field
- * @param header 		number of header lines
+ * @param header 		number of header lines (joined line by line)
  * @param nr_threads		number of threads to use
+ * @param left_join		output unmatched left lines (left outer join) ?
  *
  * @return status
  */
-static int sort(const char *input_file, const char *output_file, ssize_t memory_size, char field_delim, int key_field, size_t header, size_t nr_threads)
+static int join(const char *input_file, const char *join_file, const char *output_file, ssize_t memory_size, char field_delim, int key_field,
+		size_t header, size_t nr_threads, char left_join)
 {
-	struct chunk *chunks = NULL, *chunk;
-	FILE *fp_out = NULL;
+	const char *input_files[2] = { input_file, join_file };
+	struct buffered_reader *br[2] = { NULL, NULL };
+	struct chunk *chunks[2] = { NULL, NULL };
+	struct line left, right;
+	ssize_t run_memory_size;
+	FILE *fp_in, *fp_out = NULL;
+	struct chunk *chunk;
+	size_t i, size = 0;
+	struct stat st;
 	int ret = -1;
 
+	/* progress : both inputs are read then written (about) once */
+	for (i = 0; i < 2; i++)
+		if (strcmp(input_files[i], "-") && !stat(input_files[i], &st))
+			size += st.st_size;
+	progress_set_work(size, size);
+
+	/* divide and sort both inputs (each one gets half of memory) */
+	for (i = 0; i < 2; i++) {
+		fp_in = strcmp(input_files[i], "-") ? fopen(input_files[i], "r") : stdin;
+		if (!fp_in) {
+			fprintf(stderr, "Can't open input file \"%s\"\n", input_files[i]);
+			goto out;
+		}
+
+		/* create buffered reader */
+		br[i] = buffered_reader_create(fp_in, field_delim, key_field, header, memory_size / 2);
+		if (!br[i]) {
+			fclose(fp_in);
+			goto out;
+		}
+
+		/* divide and sort */
+		chunks[i] = __divide_and_sort(br[i], NULL, memory_size / 2, nr_threads, 0, NULL, 0, NULL, NULL);
+		fclose(fp_in);
+		if (!chunks[i])
+			goto out;
+
+		/* release reader buffer (header lines are kept) */
+		xfree(br[i]->buf);
+		br[i]->buf = NULL;
+		br[i]->buf_capacity = 0;
+	}
+
 	/* remove output file */
-	remove(output_file);
-	
-	/* open input file */
-	fp_out = fopen(output_file, "w");
+	__remove_output(output_file);
+
+	/* open output file */
+	fp_out = strcmp(output_file, "-") ? fopen(output_file, "w") : stdout;
 	if (!fp_out) {
 		fprintf(stderr, "Can't open output file \"%s\"\n", output_file);
 		goto out;
 	}
-	
-	/* divide and sort */
-	chunks = __divide_and_sort(input_file, fp_out, memory_size, field_delim, key_field, header, nr_threads);
-	if (!chunks)
+
+	/* write joined header */
+	for (i = 0; i < br[0]->nr_header_lines; i++) {
+		left.value = br[0]->header_lines[i];
+		left.value_len = strlen(left.value);
+		if (i < br[1]->nr_header_lines) {
+			right.value = br[1]->header_lines[i];
+			right.value_len = strlen(right.value);
+		}
+		if (__write_joined(fp_out, &left, i < br[1]->nr_header_lines ? &right : NULL, field_delim))
+			goto out;
+	}
+
+	/* merge both inputs at the same time */
+	progress_set_phase(PROGRESS_MERGE);
+	for (i = 0; i < 2; i++)
+		for (chunk = chunks[i]; chunk != NULL; chunk = chunk->next)
+			progress_add(PROGRESS_RUNS, 1);
+
+	run_memory_size = chunk_merge_memory(chunks, 2, memory_size);
+	if (chunk_merge_prepare(chunks[0], field_delim, key_field, run_memory_size)
+	    || chunk_merge_prepare(chunks[1], field_delim, key_field, run_memory_size))
 		goto out;
 
-	/* merge sort */
-	ret = __merge_sort(fp_out, chunks, field_delim, key_field, memory_size);
+	/* join */
+	ret = __merge_join(fp_out, chunks[0], chunks[1], field_delim, left_join);
 out:
-	/* free chunks */
-	for (chunk = chunks; chunk != NULL; chunk = chunk->next)
-		chunk_free(chunk);
+	for (i = 0; i < 2; i++) {
+		chunk_free_list(chunks[i]);
+		buffered_reader_free(br[i]);
+	}
 
-	/* close output file */
-	if (fp_out)
-		fclose(fp_out);
+	/* close output file (delayed write error fails the sort) */
+	if (fp_out && fclose(fp_out) && !ret) {
+		fprintf(stderr, "Can't write output file\n");
+		ret = -1;
+	}
 
 	return ret;
 }
 
-int main()
+/**
+ * @brief Parse a size (with optional K, M or G suffix).
+ * 
+ * @param s			string
+ *
+ * @return size
+ */
+static ssize_t parse_size(const char *s)
+{
+	char *end;
+	ssize_t size;
+
+	size = strtoll(s, &end, 10);
+	switch (*end) {
+		case 'G':
+		case 'g':
+			size *= 1024;
+			/* fall through */
+		case 'M':
+		case 'm':
+			size *= 1024;
+			/* fall through */
+		case 'K':
+		case 'k':
+			size *= 1024;
+			break;
+		default:
+			break;
+	}
+
+	return size;
+}
+
+/**
+ * @brief Print usage.
+ * 
+ * @param name			program name
+ */
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-t field_delim] [-k key_field] [-H header] [-j nr_threads] [-N] [-S memory_size] [-l limit] [-p nr_parts | -b splitters] [-T tmp_dir]... [-W work_dir] [-P status_file] [-I base_file] [-F] [-D] [-U] [-r record_size,key_offset,key_length] [-q] [-G] [-C] [-f] [-w] [-B] [-o output_file] [input_file]\n", name);
+	fprintf(stderr, "       %s -J join_file [-a] [-t field_delim] [-k key_field] [-H header] [-j nr_threads] [-N] [-S memory_size] [-q] [-C] [-f] [-w] [-B] [-o output_file] [input_file]\n", name);
+	fprintf(stderr, "       %s -m [-c] [-q] [-C] [-f] [-w] [-B] [-t field_delim] [-k key_field] [-H header] [-S memory_size] [-o output_file] input_file...\n", name);
+	fprintf(stderr, "  \"-\" reads from standard input/writes to standard output\n");
+	fprintf(stderr, "  -l outputs only the first limit lines\n");
+	fprintf(stderr, "  -p writes nr_parts range partitioned output files (output_file.i) of equal sizes (sampled quantiles)\n");
+	fprintf(stderr, "  -b writes range partitioned output files split at splitters keys (separated by ',')\n");
+	fprintf(stderr, "  -T adds a temporary directory (runs are striped across them, round robin or on most free space with -F)\n");
+	fprintf(stderr, "  -D uses direct I/O (O_DIRECT) for temporary files\n");
+	fprintf(stderr, "  -U uses blocking reads for temporary files (no io_uring read ahead)\n");
+	fprintf(stderr, "  -r sorts fixed size binary records (key is key_length bytes at key_offset, -H is ignored)\n");
+	fprintf(stderr, "  -q parses quoted CSV fields (field delimiters and newlines in double quotes)\n");
+	fprintf(stderr, "  -G sorts tags (sort key, input offset and length) instead of lines, then gathers lines from input in output order\n");
+	fprintf(stderr, "  -C compares keys in locale collation order (LC_COLLATE)\n");
+	fprintf(stderr, "  -f ignores case, -w ignores leading and trailing blanks, -B ignores leading blanks of keys\n");
+	fprintf(stderr, "  -N pins threads to NUMA nodes and moves buckets to the node sorting them (placements are reported)\n");
+	fprintf(stderr, "  -W writes runs and a manifest in work_dir, so that an interrupted sort of the same input resumes from its last run\n");
+	fprintf(stderr, "  -P refreshes progress in status_file every second (progress is also printed on SIGUSR1)\n");
+	fprintf(stderr, "  -I sorts input_file and merges it in already sorted base_file (base lines before new keys are copied as is)\n");
+	fprintf(stderr, "  -J sorts input_file and join_file and joins them on their keys while merging (-a keeps unmatched input_file lines)\n");
+	fprintf(stderr, "  -m merges already sorted input files (-c checks they are sorted)\n");
+}
+
+int main(int argc, char **argv)
 {
+	const char *input_file = INPUT_FILE, *output_file = OUTPUT_FILE;
+	size_t header = HEADER, nr_threads = NR_THREADS, limit = 0, nr_parts = 0;
+	size_t record_size = 0, key_off = 0, key_len = 0;
+	const char *splitters = NULL, *work_dir = NULL, *join_file = NULL, *status_file = NULL, *base_file = NULL, *s;
+	char field_delim = FIELD_DELIM, merge_only = 0, check = 0, left_join = 0;
+	int key_field = KEY_FIELD, key_flags = 0, numa = 0, c, ret;
 	struct rlimit rlim;
 
+	/* parse options */
+	while ((c = getopt(argc, argv, "t:k:H:j:NS:l:p:b:T:W:P:I:J:aFDUr:qGCfwBo:mch")) != -1) {
+		switch (c) {
+			case 't':
+				field_delim = *optarg;
+				break;
+			case 'k':
+				key_field = atoi(optarg);
+				break;
+			case 'H':
+				header = strtoul(optarg, NULL, 10);
+				break;
+			case 'j':
+				nr_threads = strtoul(optarg, NULL, 10);
+				break;
+			case 'N':
+				numa = 1;
+				break;
+			case 'S':
+				memory_size = parse_size(optarg);
+				break;
+			case 'l':
+				limit = strtoul(optarg, NULL, 10);
+				break;
+			case 'p':
+				nr_parts = strtoul(optarg, NULL, 10);
+				break;
+			case 'b':
+				splitters = optarg;
+				for (nr_parts = 2, s = splitters; (s = strchr(s, ',')) != NULL; s++)
+					nr_parts++;
+				break;
+			case 'T':
+				if (tmp_file_add_dir(optarg)) {
+					fprintf(stderr, "Too many temporary directories\n");
+					return 1;
+				}
+				break;
+			case 'W':
+				work_dir = optarg;
+				break;
+			case 'P':
+				status_file = optarg;
+				break;
+			case 'I':
+				base_file = optarg;
+				break;
+			case 'J':
+				join_file = optarg;
+				break;
+			case 'a':
+				left_join = 1;
+				break;
+			case 'F':
+				tmp_file_set_placement(1);
+				break;
+			case 'D':
+				tmp_file_set_direct(1);
+				break;
+			case 'U':
+				tmp_file_set_async(0);
+				break;
+			case 'r':
+				if (sscanf(optarg, "%zu,%zu,%zu", &record_size, &key_off, &key_len) != 3 || !key_len || key_off + key_len > record_size) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'q':
+				key_flags |= LINE_KEY_CSV;
+				break;
+			case 'G':
+				key_flags |= LINE_KEY_TAG;
+				break;
+			case 'C':
+				setlocale(LC_COLLATE, "");
+				key_flags |= LINE_KEY_COLLATE;
+				break;
+			case 'f':
+				key_flags |= LINE_KEY_FOLD;
+				break;
+			case 'w':
+				key_flags |= LINE_KEY_TRIM;
+				break;
+			case 'B':
+				key_flags |= LINE_KEY_BLANKS;
+				break;
+			case 'o':
+				output_file = optarg;
+				break;
+			case 'm':
+				merge_only = 1;
+				break;
+			case 'c':
+				check = 1;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	/* merge needs input files, partitions need output files */
+	if ((merge_only && optind >= argc) || (nr_parts && (merge_only || limit || !strcmp(output_file, "-")))) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* input file */
+	if (optind < argc)
+		input_file = argv[optind];
+
+	/* key options (binary records keys are compared as is, tags are gathered from a regular input file) */
+	if ((record_size && (key_flags & ~LINE_KEY_TAG)) || ((key_flags & LINE_KEY_TAG) && (merge_only || join_file || !strcmp(input_file, "-")))) {
+		usage(argv[0]);
+		return 1;
+	}
+	line_set_key_flags(key_flags);
+
+	/* binary records (no header) */
+	if (record_size) {
+		line_set_record_size(record_size, key_off, key_len);
+		header = 0;
+	}
+
+	/* resumable sort needs a seekable input and deterministic runs */
+	if (work_dir && (merge_only || !strcmp(input_file, "-") || (nr_parts && !splitters))) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* incremental merge : base run is made of plain lines (no tags), splitters can't be sampled on new lines only */
+	if (base_file && (merge_only || join_file || (key_flags & LINE_KEY_TAG) || (nr_parts && !splitters))) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* join streams merged lines of 2 sorted inputs */
+	if ((join_file && (merge_only || nr_parts || limit || work_dir || record_size || (!strcmp(input_file, "-") && !strcmp(join_file, "-"))))
+	    || (left_join && !join_file)) {
+		usage(argv[0]);
+		return 1;
+	}
+
 	/* limit memory */
 	rlim.rlim_cur = rlim.rlim_max = memory_size;
 	setrlimit(RLIMIT_AS, &rlim);
 
-	/* sort */
-	return sort(INPUT_FILE, OUTPUT_FILE, memory_size / 2, FIELD_DELIM, KEY_FIELD, HEADER, NR_THREADS);
+	/* runs buffers always mapped : freed buffers go back to the system instead of fragmenting the heap under the limit */
+	mallopt(M_MMAP_THRESHOLD, MMAP_THRESHOLD);
+
+	/* progress reporting (SIGUSR1, status file) */
+	progress_init(status_file);
+
+	/* NUMA mode : workers spread over nodes (no-op on a single node) */
+	if (numa && numa_enable())
+		thread_pool_init(nr_threads, THREAD_POOL_PIN_NODE);
+
+	/* merge sorted files or sort */
+	if (join_file)
+		ret = join(input_file, join_file, output_file, memory_size / 2, field_delim, key_field, header, nr_threads, left_join);
+	else if (merge_only)
+		ret = merge(argv + optind, argc - optind, output_file, memory_size / 2, field_delim, key_field, header, check);
+	else
+		ret = sort(input_file, output_file, memory_size / 2, field_delim, key_field, header, nr_threads, limit, nr_parts, splitters, work_dir, base_file);
+
+	/* release temporary files resources and stop workers */
+	tmp_file_exit();
+	thread_pool_exit();
+	numa_report();
+
+	/* final progress */
+	progress_exit();
+
+	return ret;
 }
\ No newline at end of file
@@ -0,0 +1,414 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "libsort.h"
+#include "chunk.h"
+#include "tmp_file.h"
+#include "mem.h"
+
+#define LIBSORT_MIN_BUF_SIZE		(64 * 1024)
+
+/**
+ * @brief Sorter.
+ */
+struct libsort {
+	char			field_delim;
+	int			key_field;
+	ssize_t			memory_size;
+	size_t			nr_threads;
+	char *			buf;
+	size_t			buf_len;
+	size_t			buf_capacity;
+	struct chunk *		chunk;
+	struct chunk *		runs;
+	int			saved_key_flags;
+	int			saved_quiet;
+};
+
+/* key options and errors mode are process wide : a single sorter may exist at a time */
+static struct libsort *libsort_current = NULL;
+
+/**
+ * @brief Sorter output callback.
+ */
+struct libsort_output {
+	int			(*output)(const char *record, size_t len, void *arg);
+	void *			arg;
+};
+
+/**
+ * @brief Create a chunk for in memory records.
+ *
+ * @param s			sorter
+ *
+ * @return chunk (NULL if memory can't be allocated)
+ */
+static struct chunk *__libsort_chunk_create(struct libsort *s)
+{
+	struct chunk *chunk;
+
+	/* number of records is unknown : grow lines array geometrically, in memory left by records buffer */
+	chunk = chunk_create(0);
+	if (!chunk)
+		return NULL;
+
+	chunk->larr->grow_slow = 0;
+	chunk->larr->max_memory = s->memory_size;
+
+	return chunk;
+}
+
+/**
+ * @brief Create a sorter.
+ *
+ * @param field_delim		field delimiter
+ * @param key_field		key field (0 = first field)
+ * @param key_flags		key options (LIBSORT_KEY_*)
+ * @param memory_size		memory budget
+ * @param nr_threads		number of threads to use
+ *
+ * @return sorter (NULL on error, errno is set : EBUSY if another sorter exists)
+ */
+struct libsort *libsort_create(char field_delim, int key_field, int key_flags, ssize_t memory_size, size_t nr_threads)
+{
+	struct libsort *s;
+
+	if (memory_size <= 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* another sorter exists */
+	if (libsort_current) {
+		errno = EBUSY;
+		return NULL;
+	}
+
+	/* allocate sorter */
+	s = (struct libsort *) malloc(sizeof(struct libsort));
+	if (!s)
+		return NULL;
+
+	s->field_delim = field_delim;
+	s->key_field = key_field;
+	s->memory_size = memory_size;
+	s->nr_threads = nr_threads;
+	s->buf = NULL;
+	s->buf_len = 0;
+	s->buf_capacity = 0;
+	s->runs = NULL;
+	s->chunk = __libsort_chunk_create(s);
+	if (!s->chunk) {
+		free(s);
+		return NULL;
+	}
+
+	/* key options (LIBSORT_KEY_* are LINE_KEY_*), errors are returned to the caller, not printed (restored by libsort_free) */
+	s->saved_key_flags = line_get_key_flags();
+	s->saved_quiet = xerror_get_quiet();
+	line_set_key_flags(key_flags);
+	xerror_set_quiet(1);
+	libsort_current = s;
+
+	return s;
+}
+
+/**
+ * @brief Free a sorter (remove its temporary files, restore key options and errors mode).
+ *
+ * @param s			sorter
+ */
+void libsort_free(struct libsort *s)
+{
+	if (!s)
+		return;
+
+	chunk_free(s->chunk);
+	chunk_free_list(s->runs);
+	xfree(s->buf);
+
+	/* restore process wide state */
+	line_set_key_flags(s->saved_key_flags);
+	xerror_set_quiet(s->saved_quiet);
+	libsort_current = NULL;
+	free(s);
+}
+
+/**
+ * @brief Sort and spill in memory records (memory budget is exceeded).
+ *
+ * @param s			sorter
+ *
+ * @return status (-1 on error, errno is set)
+ */
+static int __libsort_spill(struct libsort *s)
+{
+	struct chunk *chunk = s->chunk;
+
+	/* add run to list */
+	chunk->next = s->runs;
+	s->runs = chunk;
+
+	/* sort and write run */
+	if (chunk_sort_write(chunk, s->nr_threads, NULL))
+		return -1;
+
+	/* clear run and reuse buffer for next records */
+	chunk_clear_full(chunk);
+	s->chunk = __libsort_chunk_create(s);
+	s->buf_len = 0;
+
+	return s->chunk ? 0 : -1;
+}
+
+/**
+ * @brief Get memory used by lines array of in memory records (lines are copied when they are sorted).
+ *
+ * @param s			sorter
+ *
+ * @return memory size
+ */
+static size_t __libsort_lines_memory(struct libsort *s)
+{
+	return 2 * s->chunk->larr->capacity * sizeof(struct line) + s->chunk->larr->keys_capacity;
+}
+
+/**
+ * @brief Set memory budget of lines array (memory left by records buffer, half of it for the sort copy of lines).
+ *
+ * @param s			sorter
+ */
+static void __libsort_set_lines_memory(struct libsort *s)
+{
+	size_t left = (size_t) s->memory_size > s->buf_capacity ? s->memory_size - s->buf_capacity : 0;
+
+	s->chunk->larr->max_memory = left / 2 > sizeof(struct line) ? left / 2 : sizeof(struct line);
+}
+
+/**
+ * @brief Grow records buffer in memory budget (lines are moved to the new buffer).
+ *
+ * @param s			sorter
+ * @param len			length needed
+ *
+ * @return status (-1 = budget exceeded or memory can't be allocated)
+ */
+static int __libsort_grow(struct libsort *s, size_t len)
+{
+	struct line_array *larr = s->chunk->larr;
+	size_t capacity = s->buf_capacity, max_capacity, i;
+	uintptr_t old = (uintptr_t) s->buf;
+	struct line *line;
+
+	/* buffer takes its share of memory budget (as records and their lines used it so far), in memory left by lines */
+	max_capacity = s->memory_size;
+	if (larr->size > 0)
+		max_capacity = (double) s->memory_size * s->buf_len / (s->buf_len + 2 * larr->size * sizeof(struct line) + larr->keys_len);
+	if (max_capacity + __libsort_lines_memory(s) > (size_t) s->memory_size)
+		max_capacity = (size_t) s->memory_size > __libsort_lines_memory(s) ? s->memory_size - __libsort_lines_memory(s) : 0;
+
+	/* double buffer size (first record is always added) */
+	if (!capacity)
+		capacity = LIBSORT_MIN_BUF_SIZE;
+	while (capacity < len)
+		capacity *= 2;
+	if (capacity > max_capacity)
+		capacity = max_capacity > len ? max_capacity : len;
+	if (larr->size > 0 && capacity > max_capacity)
+		return -1;
+
+	/* reallocate buffer */
+	s->buf = (char *) realloc(s->buf, capacity);
+	if (!s->buf) {
+		s->buf = (char *) old;
+		return -1;
+	}
+
+	mem_advise_huge(s->buf, capacity);
+	s->buf_capacity = capacity;
+
+	/* rebase lines (and keys compared in place) */
+	for (i = 0; i < larr->size; i++) {
+		line = &larr->lines[i];
+		if ((uintptr_t) line->key >= old && (uintptr_t) line->key < old + s->buf_len)
+			line->key = s->buf + ((uintptr_t) line->key - old);
+		line->value = s->buf + ((uintptr_t) line->value - old);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Add a record (record is copied).
+ *
+ * @param s			sorter
+ * @param record		record
+ * @param len			record length
+ *
+ * @return status (-1 on error, errno is set)
+ */
+int libsort_add(struct libsort *s, const char *record, size_t len)
+{
+	struct line_array *larr;
+	size_t off;
+
+	/* already sorted */
+	if (!s->chunk) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* newline is added back */
+	if (len > 0 && record[len - 1] == '\n')
+		len--;
+
+	/* grow buffer if needed (records are null terminated for key parsing) : memory budget exceeded, spill records */
+	if (s->buf_len + len + 2 > s->buf_capacity && __libsort_grow(s, s->buf_len + len + 2)) {
+		if (s->chunk->larr->size == 0 || __libsort_spill(s))
+			return -1;
+
+		if (len + 2 > s->buf_capacity && __libsort_grow(s, len + 2))
+			return -1;
+	}
+
+	/* copy record */
+	memcpy(s->buf + s->buf_len, record, len);
+	s->buf[s->buf_len + len] = '\n';
+	s->buf[s->buf_len + len + 1] = 0;
+
+	/* add line (lines and keys get memory left by buffer) */
+	larr = s->chunk->larr;
+	__libsort_set_lines_memory(s);
+	if (line_array_add(larr, s->buf + s->buf_len, len + 1, s->field_delim, s->key_field)) {
+		/* lines array full : spill other records and move record to start of buffer */
+		off = s->buf_len;
+		if (larr->size == 0 || __libsort_spill(s))
+			return -1;
+
+		memmove(s->buf, s->buf + off, len + 2);
+
+		larr = s->chunk->larr;
+		__libsort_set_lines_memory(s);
+		if (line_array_add(larr, s->buf, len + 1, s->field_delim, s->key_field))
+			return -1;
+	}
+
+	s->buf_len += len + 1;
+	return 0;
+}
+
+/**
+ * @brief Add newline separated records of a buffer (records are copied).
+ *
+ * @param s			sorter
+ * @param buf			buffer
+ * @param len			buffer length
+ *
+ * @return status (-1 on error, errno is set)
+ */
+int libsort_add_buffer(struct libsort *s, const char *buf, size_t len)
+{
+	const char *end = buf + len, *ptr;
+
+	for (; buf < end; buf = ptr + 1) {
+		/* find end of record (last record may have no newline) */
+		ptr = (const char *) memchr(buf, '\n', end - buf);
+		if (!ptr)
+			ptr = end;
+
+		/* add record */
+		if (libsort_add(s, buf, ptr - buf))
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Output a merged line.
+ *
+ * @param line			line
+ * @param arg			sorter output callback
+ *
+ * @return status (-1 on error, errno is set)
+ */
+static int __libsort_output(struct line *line, void *arg)
+{
+	struct libsort_output *out = (struct libsort_output *) arg;
+
+	return out->output(line->value, line->value_len, out->arg);
+}
+
+/**
+ * @brief Sort records added so far and output them (no record can be added after).
+ *
+ * @param s			sorter
+ * @param output		output callback, called for each record (ending with a newline) in sorted order (non zero return stops the sort)
+ * @param arg			output callback argument
+ *
+ * @return status (-1 on error, errno is set)
+ */
+int libsort_sort(struct libsort *s, int (*output)(const char *record, size_t len, void *arg), void *arg)
+{
+	struct libsort_output out = { output, arg };
+	struct chunk *chunk;
+	int ret;
+
+	/* already sorted */
+	if (!s->chunk) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* in memory records must leave enough memory to merge spilled runs */
+	if (s->runs && chunk_memory_size(s->chunk) > (size_t) s->memory_size / 2 && __libsort_spill(s))
+		return -1;
+
+	/* sort in memory records (chunk takes records buffer) */
+	chunk = s->chunk;
+	line_array_sort(chunk->larr, s->nr_threads);
+	chunk->buf = s->buf;
+	s->buf = NULL;
+	s->buf_len = s->buf_capacity = 0;
+
+	/* add in memory chunk to runs */
+	chunk->next = s->runs;
+	s->runs = chunk;
+	s->chunk = NULL;
+
+	/* merge runs (nothing is read from disk if nothing was spilled) */
+	ret = chunk_merge(s->runs, s->field_delim, s->key_field, s->memory_size, 0, __libsort_output, &out);
+
+	/* release read ahead memory */
+	if (s->runs->next)
+		tmp_file_exit();
+
+	return ret;
+}
+
+/**
+ * @brief Sort records returned by an input callback.
+ *
+ * @param s			sorter
+ * @param input			input callback, returns next record and its length (NULL at end of input)
+ * @param output		output callback, called for each record (ending with a newline) in sorted order (non zero return stops the sort)
+ * @param arg			callbacks argument
+ *
+ * @return status (-1 on error, errno is set)
+ */
+int libsort_sort_records(struct libsort *s, const char *(*input)(size_t *len, void *arg),
+			 int (*output)(const char *record, size_t len, void *arg), void *arg)
+{
+	const char *record;
+	size_t len;
+
+	/* add records */
+	while ((record = input(&len, arg)) != NULL)
+		if (libsort_add(s, record, len))
+			return -1;
+
+	/* sort them */
+	return libsort_sort(s, output, arg);
+}
\ No newline at end of file
@@ -0,0 +1,92 @@
+#ifndef _LIBSORT_H_
+#define _LIBSORT_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @brief Key options (LC_COLLATE order needs setlocale(LC_COLLATE, ...) in the calling program).
+ */
+#define LIBSORT_KEY_COLLATE		0x1	/* LC_COLLATE order */
+#define LIBSORT_KEY_FOLD		0x2	/* ignore case */
+#define LIBSORT_KEY_TRIM		0x4	/* ignore leading and trailing blanks */
+#define LIBSORT_KEY_BLANKS		0x8	/* ignore leading blanks */
+
+/**
+ * @brief Sorter : records are kept in memory and sorted runs are spilled in temporary files only when the memory budget is exceeded.
+ *
+ * Records are lines (a newline is appended to records which don't end with one, records can't contain other newlines),
+ * sorted on a key field. Key options, errors mode and temporary files read ahead are process wide : a single sorter
+ * may exist at a time (libsort_create fails with EBUSY until it is freed), and libsort_free restores previous key
+ * options and errors mode.
+ * Errors are returned (errno is set), never printed, and memory allocation failures never exit the process.
+ */
+struct libsort;
+
+/**
+ * @brief Create a sorter.
+ *
+ * @param field_delim		field delimiter
+ * @param key_field		key field (0 = first field)
+ * @param key_flags		key options (LIBSORT_KEY_*)
+ * @param memory_size		memory budget
+ * @param nr_threads		number of threads to use
+ *
+ * @return sorter (NULL on error, errno is set : EBUSY if another sorter exists)
+ */
+struct libsort *libsort_create(char field_delim, int key_field, int key_flags, ssize_t memory_size, size_t nr_threads);
+
+/**
+ * @brief Free a sorter (remove its temporary files, restore key options and errors mode).
+ *
+ * @param s			sorter
+ */
+void libsort_free(struct libsort *s);
+
+/**
+ * @brief Add a record (record is copied).
+ *
+ * @param s			sorter
+ * @param record		record
+ * @param len			record length
+ *
+ * @return status (-1 on error, errno is set)
+ */
+int libsort_add(struct libsort *s, const char *record, size_t len);
+
+/**
+ * @brief Add newline separated records of a buffer (records are copied).
+ *
+ * @param s			sorter
+ * @param buf			buffer
+ * @param len			buffer length
+ *
+ * @return status (-1 on error, errno is set)
+ */
+int libsort_add_buffer(struct libsort *s, const char *buf, size_t len);
+
+/**
+ * @brief Sort records added so far and output them (no record can be added after).
+ *
+ * @param s			sorter
+ * @param output		output callback, called for each record (ending with a newline) in sorted order (non zero return stops the sort)
+ * @param arg			output callback argument
+ *
+ * @return status (-1 on error, errno is set)
+ */
+int libsort_sort(struct libsort *s, int (*output)(const char *record, size_t len, void *arg), void *arg);
+
+/**
+ * @brief Sort records returned by an input callback.
+ *
+ * @param s			sorter
+ * @param input			input callback, returns next record and its length (NULL at end of input)
+ * @param output		output callback, called for each record (ending with a newline) in sorted order (non zero return stops the sort)
+ * @param arg			callbacks argument
+ *
+ * @return status (-1 on error, errno is set)
+ */
+int libsort_sort_records(struct libsort *s, const char *(*input)(size_t *len, void *arg),
+			 int (*output)(const char *record, size_t len, void *arg), void *arg);
+
+#endif
\ No newline at end of file
@@ -1,12 +1,41 @@
+#define _GNU_SOURCE
 #include <string.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "line.h"
+#include "thread_pool.h"
+#include "numa.h"
 #include "mem.h"
 
 #define NR_BUCKETS			256
 #define INITIAL_SIZE			10
+#define MIN_RUN_LENGTH			32
+#define KEYS_INITIAL_SIZE		4096
+#define KEY_ESCAPE			'\001'
+#define RECORD_DELIM			'\t'
+#define RADIX_MAX_KEY_LEN		16
+#define CSV_QUOTE			'"'
+#define TAG_MAX_LEN			48
+#define PWRITE_BUF_SIZE			(1024 * 1024)
+#define PWRITE_SLICES_PER_THREAD	4
+
+/* key options (LINE_KEY_*) */
+static int line_key_flags = 0;
+
+/* sort keys are stored out of lines (case folding, collation or tags) ? */
+#define KEYS_OUT_OF_LINE	(line_key_flags & (LINE_KEY_FOLD | LINE_KEY_COLLATE | LINE_KEY_TAG))
+
+/* fixed size binary records (0 = text lines) */
+static size_t line_record_size = 0;
+static size_t line_record_key_off = 0;
+static size_t line_record_key_len = 0;
+
+/* short fixed keys are radix sorted (one pass per key byte) ? */
+#define RADIX_KEYS		(line_record_size && line_record_key_len <= RADIX_MAX_KEY_LEN)
 
 /**
  * @brief Thread sort argument.
@@ -14,41 +43,195 @@
 struct thread_sort_arg {
 	struct line_array **	buckets;
 	size_t			i;
-	pthread_mutex_t 	lock;
+};
+
+/**
+ * @brief Thread merge argument (one merge pass over natural runs).
+ */
+struct thread_merge_arg {
+	struct line *		src;
+	struct line *		dst;
+	size_t *		runs;
+	size_t			nr_runs;
+	size_t			i;
+};
+
+/**
+ * @brief Thread positioned write argument (sorted lines are cut in slices written at their own offset).
+ */
+struct thread_pwrite_arg {
+	struct line_array *	larr;
+	int			fd;
+	off_t *			offsets;
+	size_t			nr_slices;
+	size_t			i;
+	int			ret;
 };
 
 
 /**
- * @brief Init a line.
+ * @brief Set key options.
+ * 
+ * @param flags			key options (LINE_KEY_*)
+ */
+void line_set_key_flags(int flags)
+{
+	line_key_flags = flags;
+}
+
+/**
+ * @brief Get key options.
+ * 
+ * @return key options (LINE_KEY_*)
+ */
+int line_get_key_flags()
+{
+	return line_key_flags;
+}
+
+/**
+ * @brief Set fixed size binary records mode (records are not parsed : key is at a fixed offset).
+ * 
+ * @param record_size		record size (0 = newline terminated text lines)
+ * @param key_off		key offset in record
+ * @param key_len		key length
+ */
+void line_set_record_size(size_t record_size, size_t key_off, size_t key_len)
+{
+	line_record_size = record_size;
+	line_record_key_off = key_off;
+	line_record_key_len = key_len;
+}
+
+/**
+ * @brief Get record size.
+ * 
+ * @return record size (0 = newline terminated text lines)
+ */
+size_t line_get_record_size()
+{
+	return line_record_size;
+}
+
+/**
+ * @brief Get record key position.
+ * 
+ * @param key_off		key offset in record (output)
+ * @param key_len		key length (output)
+ */
+void line_get_record_key(size_t *key_off, size_t *key_len)
+{
+	*key_off = line_record_key_off;
+	*key_len = line_record_key_len;
+}
+
+/**
+ * @brief Compute sort key of a key : strxfrm() output, with bytes <= '\n' escaped (escape + byte + 0x10)
+ * so that it never contains line or record delimiters and still compares in the same order with memcmp().
+ * 
+ * @param key			key (a null byte is temporarily written after it)
+ * @param key_len		key length
+ * @param dst			sort key (output)
+ * @param size			sort key buffer size
+ *
+ * @return sort key length (> size if buffer is too small)
+ */
+static size_t __collate_key(char *key, int key_len, char *dst, size_t size)
+{
+	size_t len, nr_escapes = 0, i, j;
+	char saved;
+
+	/* transform key */
+	saved = key[key_len];
+	key[key_len] = 0;
+	len = strxfrm(dst, key, size);
+	key[key_len] = saved;
+
+	/* buffer too small (escapes can double length) */
+	if (len >= size)
+		return 2 * len + 1;
+
+	/* count escapes */
+	for (i = 0; i < len; i++)
+		if ((unsigned char) dst[i] <= '\n')
+			nr_escapes++;
+
+	if (len + nr_escapes > size)
+		return len + nr_escapes;
+
+	/* escape bytes in place, from the end */
+	for (i = len, j = len + nr_escapes; i > 0; i--) {
+		if ((unsigned char) dst[i - 1] <= '\n') {
+			dst[--j] = dst[i - 1] + 0x10;
+			dst[--j] = KEY_ESCAPE;
+		} else {
+			dst[--j] = dst[i - 1];
+		}
+	}
+
+	return len + nr_escapes;
+}
+
+/**
+ * @brief Get sort key size of a line (memory needed per line when sort keys are stored out of lines).
  * 
- * @param line			line
  * @param value 		line value
  * @param value_len		value length
  * @param field_delim 		field delimiter
  * @param key_field 		key field
+ *
+ * @return sort key size (0 if keys are compared in place)
  */
-void line_init(struct line *line, char *value, int value_len, char field_delim, int key_field)
+size_t line_key_size(char *value, int value_len, char field_delim, int key_field)
 {
-	char *kend;
+	struct line line;
+	char saved;
+	size_t len;
 
-	/* set value */
-	line->value = value;
-	line->value_len = value_len;
+	if (!KEYS_OUT_OF_LINE)
+		return 0;
 
-	/* find key start */
+	/* normalized key length */
+	line_init(&line, value, value_len, field_delim, key_field);
+	if (!line.key)
+		return 0;
+	if (!(line_key_flags & LINE_KEY_COLLATE))
+		return line.key_len;
+
+	/* transformed key length (escapes are rare) */
+	saved = line.key[line.key_len];
+	line.key[line.key_len] = 0;
+	len = strxfrm(NULL, line.key, 0);
+	line.key[line.key_len] = saved;
+
+	return len;
+}
+
+/**
+ * @brief Find key of a line (plain fields).
+ * 
+ * @param line			line
+ * @param field_delim 		field delimiter
+ * @param key_field 		key field
+ */
+static void __find_key(struct line *line, char field_delim, int key_field)
+{
+	char *end = line->value + line->value_len, *kend;
+
+	/* find key start (lines may not be null terminated, as lines forecast in read ahead blocks) */
 	line->key = line->value;
-	while (key_field-- && (line->key = strchr(line->key, field_delim)))
+	while (key_field-- && (line->key = (char *) memchr(line->key, field_delim, end - line->key)))
 		line->key++;
 
 	/* key out of value */
-	if (line->key >= value + value_len)
+	if (line->key >= end)
 		line->key = NULL;
 
 	/* compute key end and length */
 	if (line->key) {
-		kend = strchrnul(line->key, field_delim);
-		if (kend > value + value_len)
-			kend = value + value_len;
+		kend = (char *) memchr(line->key, field_delim, end - line->key);
+		if (!kend)
+			kend = end;
 
 		line->key_len = (size_t) (kend - line->key);
 	} else {
@@ -56,6 +239,191 @@ void line_init(struct line *line, char *value, int value_len, char field_delim,
 	}
 }
 
+/**
+ * @brief Find key of a line with quoted CSV fields (delimiters and newlines in quotes are part of fields).
+ * 
+ * @param line			line
+ * @param field_delim 		field delimiter
+ * @param key_field 		key field
+ */
+static void __csv_find_key(struct line *line, char field_delim, int key_field)
+{
+	char *s = line->value, *end = line->value + line->value_len, *q;
+	int quoted = 0;
+
+	/* find key start */
+	for (; s < end && key_field > 0; s++) {
+		if (*s == CSV_QUOTE)
+			quoted = !quoted;
+		else if (*s == field_delim && !quoted)
+			key_field--;
+	}
+
+	/* key out of value */
+	if (key_field > 0 || s >= end) {
+		line->key = NULL;
+		line->key_len = 0;
+		return;
+	}
+
+	/* find key end */
+	for (line->key = s, quoted = 0; s < end; s++) {
+		if (*s == CSV_QUOTE)
+			quoted = !quoted;
+		else if (*s == field_delim && !quoted)
+			break;
+	}
+	line->key_len = s - line->key;
+
+	/* quoted key : compare field content (between quotes) */
+	if (*line->key == CSV_QUOTE && (q = (char *) memrchr(line->key + 1, CSV_QUOTE, line->key_len - 1)) != NULL) {
+		line->key++;
+		line->key_len = q - line->key;
+	}
+}
+
+/**
+ * @brief Find end of a line with quoted CSV fields (newlines in quotes don't end the line).
+ * 
+ * @param s			line start (in a null terminated buffer)
+ * @param record		spilled run record (sort key before line is skipped) ?
+ *
+ * @return end of line (newline, or null byte if line is not complete)
+ */
+char *line_csv_end(char *s, int record)
+{
+	char *ptr;
+	int quoted = 0;
+
+	/* sort key (no newline or record delimiter in it) */
+	if (record && KEYS_OUT_OF_LINE && (ptr = strchr(s, RECORD_DELIM)) != NULL)
+		s = ptr + 1;
+
+	/* no quote in line : first newline */
+	ptr = strchrnul(s, '\n');
+	if (!memchr(s, CSV_QUOTE, ptr - s))
+		return ptr;
+
+	/* skip newlines in quotes */
+	for (; *s; s++) {
+		if (*s == CSV_QUOTE)
+			quoted = !quoted;
+		else if (*s == '\n' && !quoted)
+			break;
+	}
+
+	return s;
+}
+
+/**
+ * @brief Init a line.
+ * 
+ * @param line			line
+ * @param value 		line value
+ * @param value_len		value length
+ * @param field_delim 		field delimiter
+ * @param key_field 		key field
+ */
+void line_init(struct line *line, char *value, int value_len, char field_delim, int key_field)
+{
+	/* set value */
+	line->value = value;
+	line->value_len = value_len;
+
+	/* binary record : fixed key (truncated record at end of input may have a shorter key) */
+	if (line_record_size) {
+		line->key = value + line_record_key_off;
+		line->key_len = (size_t) value_len > line_record_key_off ? value_len - line_record_key_off : 0;
+		if ((size_t) line->key_len > line_record_key_len)
+			line->key_len = line_record_key_len;
+		return;
+	}
+
+	/* find key (lines without quotes take the plain fields path) */
+	if ((line_key_flags & LINE_KEY_CSV) && memchr(value, CSV_QUOTE, value_len))
+		__csv_find_key(line, field_delim, key_field);
+	else
+		__find_key(line, field_delim, key_field);
+
+	/* no key */
+	if (!line->key)
+		return;
+
+	/* ignore leading blanks */
+	if (line_key_flags & (LINE_KEY_BLANKS | LINE_KEY_TRIM))
+		for (; line->key_len > 0 && isblank((unsigned char) *line->key); line->key_len--)
+			line->key++;
+
+	/* ignore trailing blanks (and end of line) */
+	if (line_key_flags & LINE_KEY_TRIM)
+		for (; line->key_len > 0 && isspace((unsigned char) line->key[line->key_len - 1]); line->key_len--)
+			;
+}
+
+/**
+ * @brief Init a line from a spilled run record (sort key is carried before the line when it is not in the line).
+ * 
+ * @param line			line
+ * @param record 		record
+ * @param record_len		record length
+ * @param field_delim 		field delimiter
+ * @param key_field 		key field
+ */
+void line_init_record(struct line *line, char *record, int record_len, char field_delim, int key_field)
+{
+	char *delim;
+
+	/* plain line */
+	if (!KEYS_OUT_OF_LINE) {
+		line_init(line, record, record_len, field_delim, key_field);
+		return;
+	}
+
+	/* sort key, record delimiter then line */
+	delim = (char *) memchr(record, RECORD_DELIM, record_len);
+	if (!delim)
+		delim = record;
+
+	line->key = delim > record ? record : NULL;
+	line->key_len = delim - record;
+	line->value = delim + 1;
+	line->value_len = record_len - (delim + 1 - record);
+}
+
+/**
+ * @brief Duplicate a line (value and sort key are copied in a single allocation).
+ * 
+ * @param dst 			destination line
+ * @param src 			source line
+ *
+ * @return status (-1 if memory can't be allocated)
+ */
+int line_dup(struct line *dst, const struct line *src)
+{
+	int key_in_value = src->key >= src->value && src->key < src->value + src->value_len;
+
+	/* copy value */
+	dst->value = (char *) malloc(src->value_len + (key_in_value ? 0 : src->key_len));
+	if (!dst->value)
+		return -1;
+
+	memcpy(dst->value, src->value, src->value_len);
+	dst->value_len = src->value_len;
+	dst->key_len = src->key_len;
+
+	/* sort key (case folded or collated) is stored after value */
+	if (!src->key) {
+		dst->key = NULL;
+	} else if (key_in_value) {
+		dst->key = dst->value + (src->key - src->value);
+	} else {
+		dst->key = dst->value + dst->value_len;
+		memcpy(dst->key, src->key, src->key_len);
+	}
+
+	return 0;
+}
+
 /**
  * @brief Compare 2 lines.
  * 
@@ -72,8 +440,8 @@ int line_compare(const struct line *line1, const struct line *line2)
 	/* find maximum length */
 	len = line1->key_len < line2->key_len ? line1->key_len : line2->key_len;
 
-	/* compare keys */
-	ret = strncmp(line1->key, line2->key, len);
+	/* compare keys (or sort keys) */
+	ret = memcmp(line1->key, line2->key, len);
 	if (ret)
 		return ret;
 
@@ -86,23 +454,32 @@ int line_compare(const struct line *line1, const struct line *line2)
  * @param capacity	initial capacity
  * @param grow_slow	grow slow ?
  * 
- * @return line array
+ * @return line array (NULL if memory can't be allocated)
  */
 struct line_array *line_array_create(size_t capacity, char grow_slow)
 {
 	struct line_array *larr;
 
 	/* create array */
-	larr = (struct line_array *) xmalloc(sizeof(struct line_array));
+	larr = (struct line_array *) malloc(sizeof(struct line_array));
+	if (!larr)
+		return NULL;
+
 	larr->capacity = capacity;
 	larr->size = 0;
 	larr->grow_slow = grow_slow;
+	larr->keys = NULL;
+	larr->keys_len = 0;
+	larr->keys_capacity = 0;
+	larr->max_memory = 0;
+	larr->full = 0;
 
 	/* allocate array */
-	if (capacity)
-		larr->lines = (struct line *) xmalloc(sizeof(struct line) * capacity);
-	else
-		larr->lines = NULL;
+	larr->lines = NULL;
+	if (capacity && !(larr->lines = (struct line *) mem_alloc_huge(sizeof(struct line) * capacity))) {
+		free(larr);
+		return NULL;
+	}
 
 	return larr;
 }
@@ -137,138 +514,542 @@ void line_array_clear_full(struct line_array *larr)
 		larr->lines = NULL;
 	}
 
+	/* clear sort keys */
+	xfree(larr->keys);
+	larr->keys = NULL;
+	larr->keys_len = 0;
+	larr->keys_capacity = 0;
+
 	/* reset size */
 	larr->size = 0;
 	larr->capacity = 0;
+	larr->full = 0;
+}
+
+/**
+ * @brief Reallocate lines or sort keys of a memory bounded line array (array is full if memory budget or system memory is exceeded).
+ * 
+ * @param larr 		line array
+ * @param ptr		memory to reallocate
+ * @param size		size to allocate
+ * @param other_size	size of other line array memory
+ *
+ * @return allocated memory (NULL if line array is full)
+ */
+static void *__line_array_realloc(struct line_array *larr, void *ptr, size_t size, size_t other_size)
+{
+	/* unbounded array : allocation failure is fatal */
+	if (!larr->max_memory) {
+		ptr = xrealloc(ptr, size);
+		mem_advise_huge(ptr, size);
+		return ptr;
+	}
+
+	/* first line is always added, so a run can't be empty */
+	if (larr->size > 0 && size + other_size > larr->max_memory)
+		ptr = NULL;
+	else
+		ptr = realloc(ptr, size);
+
+	if (!ptr)
+		larr->full = 1;
+
+	mem_advise_huge(ptr, size);
+	return ptr;
 }
 
 /**
  * @brief Grow a line array.
  * 
  * @param larr 		line array
+ *
+ * @return status (-1 = line array is full)
  */
-static void __line_array_grow(struct line_array *larr)
+static int __line_array_grow(struct line_array *larr)
 {
+	struct line *lines;
+	size_t capacity;
+
 	/* no need to grow */
 	if (larr->size != larr->capacity)
-		return;
+		return 0;
 
 	/* set new capacity */
 	if (larr->grow_slow) {
-		larr->capacity++;
+		capacity = larr->capacity + 1;
 	} else {
-		larr->capacity = larr->capacity + (larr->capacity >> 1);
-		if (larr->capacity < INITIAL_SIZE)
-			larr->capacity = INITIAL_SIZE;
+		capacity = larr->capacity + (larr->capacity >> 1);
+		if (capacity < INITIAL_SIZE)
+			capacity = INITIAL_SIZE;
 	}
-	
+
+	/* memory bounded array : last growth takes what is left of budget */
+	if (larr->max_memory && capacity * sizeof(struct line) + larr->keys_capacity > larr->max_memory
+	    && (larr->capacity + 1) * sizeof(struct line) + larr->keys_capacity <= larr->max_memory)
+		capacity = (larr->max_memory - larr->keys_capacity) / sizeof(struct line);
+
 	/* reallocate lines */
-	larr->lines = (struct line *) xrealloc(larr->lines, sizeof(struct line) * larr->capacity);
+	lines = (struct line *) __line_array_realloc(larr, larr->lines, sizeof(struct line) * capacity, larr->keys_capacity);
+	if (!lines)
+		return -1;
+
+	larr->lines = lines;
+	larr->capacity = capacity;
+	return 0;
 }
 
 /**
- * @brief Add a line.
+ * @brief Grow sort keys buffer (keys of lines are moved with it).
  * 
- * @param larr			line array
- * @param value 		line value
- * @param value_len		line value length
- * @param field_delim 		field delimiter
- * @param key_field 		key field
+ * @param larr 		line array
+ * @param size		needed size
+ *
+ * @return status (-1 = line array is full)
  */
-void line_array_add(struct line_array *larr, char *value, size_t value_len, char field_delim, int key_field)
+static int __line_array_grow_keys(struct line_array *larr, size_t size)
 {
-	/* grow lines array if needed */
-	__line_array_grow(larr);
+	size_t lines_size = larr->capacity * sizeof(struct line), capacity, i;
+	char *keys = larr->keys, *new_keys;
 
-	/* add line */
-	line_init(&larr->lines[larr->size++], value, value_len, field_delim, key_field);
-}
+	/* set new capacity */
+	capacity = larr->keys_capacity * 2 > size ? larr->keys_capacity * 2 : size;
+	if (capacity < KEYS_INITIAL_SIZE)
+		capacity = KEYS_INITIAL_SIZE;
 
-/**
- * @brief Add a line.
- * 
- * @param larr			line array
- * @param line			line to add
- */
-static void __line_array_add(struct line_array *larr, struct line *line)
-{
-	/* grow lines array if needed */
-	__line_array_grow(larr);
+	/* memory bounded array : last growth takes what is left of budget */
+	if (larr->max_memory && capacity + lines_size > larr->max_memory && size + lines_size <= larr->max_memory)
+		capacity = larr->max_memory - lines_size;
 
-	/* add line */
-	larr->lines[larr->size++] = *line;
+	/* reallocate keys */
+	new_keys = (char *) __line_array_realloc(larr, larr->keys, capacity, lines_size);
+	if (!new_keys)
+		return -1;
+
+	larr->keys = new_keys;
+	larr->keys_capacity = capacity;
+
+	/* move keys (and tags) of lines */
+	for (i = 0; i < larr->size; i++) {
+		if (larr->lines[i].key >= keys && larr->lines[i].key < keys + larr->keys_len)
+			larr->lines[i].key = larr->keys + (larr->lines[i].key - keys);
+		if (larr->lines[i].value >= keys && larr->lines[i].value < keys + larr->keys_len)
+			larr->lines[i].value = larr->keys + (larr->lines[i].value - keys);
+	}
+
+	return 0;
 }
 
 /**
- * @brief Sort a line array.
+ * @brief Replace key of a line by its sort key (case folded and/or collated, stored in line array sort keys buffer).
  * 
- * @param lines 		lines
- * @param nr_lines		number of lines
+ * @param larr 		line array
+ * @param line		line
+ *
+ * @return status (-1 = line array is full)
  */
-static void __qsort(struct line *lines, size_t nr_lines)
+static int __line_array_sort_key(struct line_array *larr, struct line *line)
 {
-	struct line pivot, tmp;
-	int i, j;
+	size_t off, len, nr_escapes = 0, j;
+	unsigned char c;
+	char *key;
+	int i;
 
-	if (nr_lines < 2)
-		return;
+	if (!line->key)
+		return 0;
+
+	/* first line : reuse keys buffer */
+	if (larr->size == 0)
+		larr->keys_len = 0;
+	off = larr->keys_len;
+
+	/* case fold or tag : write (folded) key at end of keys buffer (room is kept for a null byte) */
+	if (line_key_flags & (LINE_KEY_FOLD | LINE_KEY_TAG)) {
+		/* folded key is the sort key : escape it as collated keys */
+		if (!(line_key_flags & LINE_KEY_COLLATE))
+			for (i = 0; i < line->key_len; i++)
+				if ((unsigned char) line->key[i] <= '\n')
+					nr_escapes++;
+
+		if (off + line->key_len + nr_escapes + 1 > larr->keys_capacity && __line_array_grow_keys(larr, off + line->key_len + nr_escapes + 1))
+			return -1;
 
-	pivot = lines[nr_lines / 2];
+		for (i = 0, j = off; i < line->key_len; i++) {
+			c = line_key_flags & LINE_KEY_FOLD ? tolower((unsigned char) line->key[i]) : (unsigned char) line->key[i];
+			if (nr_escapes && c <= '\n') {
+				larr->keys[j++] = KEY_ESCAPE;
+				c += 0x10;
+			}
+			larr->keys[j++] = c;
+		}
 
-	for (i = 0, j = nr_lines - 1; ; i++, j--) {
-		while (line_compare(&lines[i], &pivot) < 0)
-			i++;
+		/* folded key is the sort key */
+		if (!(line_key_flags & LINE_KEY_COLLATE)) {
+			line->key = larr->keys + off;
+			line->key_len = j - off;
+			larr->keys_len = j;
+			return 0;
+		}
 
-		while (line_compare(&lines[j], &pivot) > 0)
-			j--;
+		larr->keys_len = j + 1;
+	}
 
-		if (i >= j)
+	/* collate : transform key at end of keys buffer (grow it and retry if too small) */
+	for (;;) {
+		key = line_key_flags & (LINE_KEY_FOLD | LINE_KEY_TAG) ? larr->keys + off : line->key;
+		len = __collate_key(key, line->key_len, larr->keys + larr->keys_len, larr->keys_capacity - larr->keys_len);
+		if (larr->keys_len + len <= larr->keys_capacity)
 			break;
 
-		tmp = lines[i];
-		lines[i] = lines[j];
-		lines[j] = tmp;
+		if (__line_array_grow_keys(larr, larr->keys_len + len)) {
+			larr->keys_len = off;
+			return -1;
+		}
+	}
+
+	/* sort key replaces folded key */
+	if (larr->keys_len != off) {
+		memmove(larr->keys + off, larr->keys + larr->keys_len, len);
+		larr->keys_len = off;
 	}
 
-	__qsort(lines, i);
-	__qsort(lines + i, nr_lines - i);
+	line->key = larr->keys + larr->keys_len;
+	line->key_len = len;
+	larr->keys_len += len;
+	return 0;
 }
 
 /**
- * @brief Sort a line array (thread function).
+ * @brief Add a line.
  * 
- * @param arg 			thread argument
- *
- * @return status
+ * @param larr			line array
+ * @param value 		line value
+ * @param value_len		line value length
+ * @param field_delim 		field delimiter
+ * @param key_field 		key field
+ *
+ * @return status (-1 = line array is full, line is not added)
  */
-static void *__sort_thread(void *arg)
+int line_array_add(struct line_array *larr, char *value, size_t value_len, char field_delim, int key_field)
+{
+	/* grow lines array if needed */
+	if (__line_array_grow(larr))
+		return -1;
+
+	/* add line */
+	line_init(&larr->lines[larr->size], value, value_len, field_delim, key_field);
+
+	/* compute sort key once */
+	if (KEYS_OUT_OF_LINE && __line_array_sort_key(larr, &larr->lines[larr->size]))
+		return -1;
+
+	larr->size++;
+	return 0;
+}
+
+/**
+ * @brief Add a line which is its own key (partition splitters : no field or record key offset).
+ * 
+ * @param larr			line array
+ * @param value 		line value (and key)
+ * @param value_len		line value length
+ *
+ * @return status (-1 = line array is full, line is not added)
+ */
+int line_array_add_key(struct line_array *larr, char *value, size_t value_len)
+{
+	struct line *line;
+
+	/* grow lines array if needed */
+	if (__line_array_grow(larr))
+		return -1;
+
+	/* add line */
+	line = &larr->lines[larr->size];
+	line->value = line->key = value;
+	line->value_len = line->key_len = value_len;
+
+	/* compute sort key once */
+	if (KEYS_OUT_OF_LINE && __line_array_sort_key(larr, line))
+		return -1;
+
+	larr->size++;
+	return 0;
+}
+
+/**
+ * @brief Add a line as a tag (value is "input_offset length\n", sort key is copied, so line text can be dropped).
+ * 
+ * @param larr		line array
+ * @param value 	line value
+ * @param value_len	line value length
+ * @param off		line input offset
+ * @param field_delim	field delimiter
+ * @param key_field 	key field
+ *
+ * @return status (-1 = line array is full, line is not added)
+ */
+int line_array_add_tag(struct line_array *larr, char *value, size_t value_len, off_t off, char field_delim, int key_field)
+{
+	struct line *line;
+	size_t key_off;
+
+	/* grow lines array if needed */
+	if (__line_array_grow(larr))
+		return -1;
+
+	/* add line and copy its sort key */
+	line = &larr->lines[larr->size];
+	line_init(line, value, value_len, field_delim, key_field);
+	if (__line_array_sort_key(larr, line))
+		return -1;
+
+	/* make room for tag (sort key of this line moves with keys buffer) */
+	if (larr->keys_len + TAG_MAX_LEN > larr->keys_capacity) {
+		key_off = line->key ? line->key - larr->keys : 0;
+		if (__line_array_grow_keys(larr, larr->keys_len + TAG_MAX_LEN)) {
+			if (line->key)
+				larr->keys_len = key_off;
+			return -1;
+		}
+
+		if (line->key)
+			line->key = larr->keys + key_off;
+	}
+
+	/* tag replaces value */
+	line->value = larr->keys + larr->keys_len;
+	line->value_len = snprintf(line->value, TAG_MAX_LEN, "%lld %zu\n", (long long) off, value_len);
+	larr->keys_len += line->value_len;
+
+	larr->size++;
+	return 0;
+}
+
+/**
+ * @brief Parse a tag.
+ * 
+ * @param line		tag line
+ * @param len		line length (output)
+ *
+ * @return line input offset
+ */
+off_t line_tag_parse(const struct line *line, size_t *len)
+{
+	char *end;
+	off_t off;
+
+	off = strtoll(line->value, &end, 10);
+	*len = strtoul(end, NULL, 10);
+
+	return off;
+}
+
+/**
+ * @brief Add a line from a spilled run record.
+ * 
+ * @param larr		line array
+ * @param record 	record
+ * @param record_len	record length
+ * @param field_delim	field delimiter
+ * @param key_field 	key field
+ *
+ * @return status (-1 = line array is full, line is not added)
+ */
+int line_array_add_record(struct line_array *larr, char *record, size_t record_len, char field_delim, int key_field)
+{
+	/* grow lines array if needed */
+	if (__line_array_grow(larr))
+		return -1;
+
+	/* add line (sort key is already computed) */
+	line_init_record(&larr->lines[larr->size++], record, record_len, field_delim, key_field);
+	return 0;
+}
+
+/**
+ * @brief Add a line.
+ * 
+ * @param larr			line array
+ * @param line			line to add
+ */
+static void __line_array_add(struct line_array *larr, struct line *line)
+{
+	/* grow lines array if needed */
+	if (__line_array_grow(larr))
+		return;
+
+	/* add line */
+	larr->lines[larr->size++] = *line;
+}
+
+/**
+ * @brief Add an already parsed line.
+ * 
+ * @param larr			line array
+ * @param line			line to add
+ */
+void line_array_add_line(struct line_array *larr, struct line *line)
+{
+	__line_array_add(larr, line);
+}
+
+/**
+ * @brief Sort a line array (smaller part is sorted recursively, larger one in place : stack depth is logarithmic).
+ * 
+ * @param lines 		lines
+ * @param nr_lines		number of lines
+ */
+static void __qsort(struct line *lines, size_t nr_lines)
+{
+	struct line pivot, tmp;
+	int i, j;
+
+	while (nr_lines >= 2) {
+		pivot = lines[nr_lines / 2];
+
+		for (i = 0, j = nr_lines - 1; ; i++, j--) {
+			while (line_compare(&lines[i], &pivot) < 0)
+				i++;
+
+			while (line_compare(&lines[j], &pivot) > 0)
+				j--;
+
+			if (i >= j)
+				break;
+
+			tmp = lines[i];
+			lines[i] = lines[j];
+			lines[j] = tmp;
+		}
+
+		if ((size_t) i < nr_lines - i) {
+			__qsort(lines, i);
+			lines += i;
+			nr_lines -= i;
+		} else {
+			__qsort(lines + i, nr_lines - i);
+			nr_lines = i;
+		}
+	}
+}
+
+/**
+ * @brief Get radix digit of a line (missing bytes of shorter keys go first).
+ * 
+ * @param line 		line
+ * @param pos		key byte position
+ *
+ * @return digit
+ */
+static inline int __radix_digit(const struct line *line, int pos)
+{
+	return pos < line->key_len ? (unsigned char) line->key[pos] + 1 : 0;
+}
+
+/**
+ * @brief Sort a line array with a LSD radix sort on keys bytes (stable, one pass per key byte).
+ * 
+ * @param lines 		lines
+ * @param nr_lines		number of lines
+ */
+static void __radix_sort(struct line *lines, size_t nr_lines)
+{
+	struct line *src = lines, *dst, *tmp;
+	size_t counts[NR_BUCKETS + 1];
+	size_t i, sum, count;
+	int key_len = 0, pos, d;
+
+	if (nr_lines < 2)
+		return;
+
+	/* find longest key */
+	for (i = 0; i < nr_lines; i++)
+		if (lines[i].key_len > key_len)
+			key_len = lines[i].key_len;
+
+	/* not enough memory for a copy : sort in place */
+	dst = tmp = (struct line *) mem_alloc_huge(sizeof(struct line) * nr_lines);
+	if (!tmp) {
+		__qsort(lines, nr_lines);
+		return;
+	}
+
+	/* from last to first key byte */
+	for (pos = key_len - 1; pos >= 0; pos--) {
+		/* count digits */
+		memset(counts, 0, sizeof(counts));
+		for (i = 0; i < nr_lines; i++)
+			counts[__radix_digit(&src[i], pos)]++;
+
+		/* same digit for all lines : nothing to do */
+		if (counts[__radix_digit(&src[0], pos)] == nr_lines)
+			continue;
+
+		/* compute digits positions */
+		for (d = 0, sum = 0; d <= NR_BUCKETS; d++) {
+			count = counts[d];
+			counts[d] = sum;
+			sum += count;
+		}
+
+		/* scatter lines */
+		for (i = 0; i < nr_lines; i++)
+			dst[counts[__radix_digit(&src[i], pos)]++] = src[i];
+
+		/* swap buffers */
+		dst = src;
+		src = src == tmp ? lines : tmp;
+	}
+
+	/* copy result */
+	if (src == tmp)
+		memcpy(lines, tmp, sizeof(struct line) * nr_lines);
+
+	xfree(tmp);
+}
+
+/**
+ * @brief Sort buckets of a line array (thread pool task).
+ * 
+ * @param arg 			thread argument
+ */
+static void __sort_thread(void *arg)
 {
 	struct thread_sort_arg *targ = (struct thread_sort_arg *) arg;
 	struct line_array *larr;
+	size_t i;
 
 	for (;;) {
 		/* get next bucket */
-		pthread_mutex_lock(&targ->lock);
-		for (;;) {
-			/* no more buckets */
-			if (targ->i >= NR_BUCKETS) {
-				pthread_mutex_unlock(&targ->lock);
-				goto end;
-			}
+		i = __atomic_fetch_add(&targ->i, 1, __ATOMIC_RELAXED);
+		if (i >= NR_BUCKETS)
+			break;
+
+		larr = targ->buckets[i];
+		if (!larr)
+			continue;
+
+		/* NUMA mode : bucket lines were written by parsing thread, move them to the node of sorting thread */
+		numa_place(larr->lines, sizeof(struct line) * larr->size);
 
-			/* get next bucket */
-			larr = targ->buckets[targ->i++];
-			if (larr)
-				break;
-		}
-		pthread_mutex_unlock(&targ->lock);
-	
 		/* sort bucket */
-		__qsort(larr->lines, larr->size);
+		if (RADIX_KEYS)
+			__radix_sort(larr->lines, larr->size);
+		else
+			__qsort(larr->lines, larr->size);
 	}
+}
 
-end:
-	return NULL;
+/**
+ * @brief Get bucket of a line (empty keys go first).
+ * 
+ * @param line 		line
+ *
+ * @return bucket
+ */
+static inline int __bucket(const struct line *line)
+{
+	return line->key_len > 0 ? (unsigned char) line->key[0] : 0;
 }
 
 /**
@@ -276,7 +1057,7 @@ end:
  * 
  * @param larr 		line array
  *
- * @return buckets
+ * @return buckets (NULL if there's not enough memory to copy lines)
  */
 static struct line_array **__create_buckets(struct line_array *larr)
 {
@@ -287,49 +1068,235 @@ static struct line_array **__create_buckets(struct line_array *larr)
 	/* compute sizes of buckets */
 	memset(counts, 0, sizeof(int) * NR_BUCKETS);
 	for (i = 0; i < larr->size; i++)
-		counts[(unsigned char) larr->lines[i].key[0]]++;
+		counts[__bucket(&larr->lines[i])]++;
+
+	/* create buckets (lines copies are allocated last, memory may be short) */
+	buckets = (struct line_array **) calloc(NR_BUCKETS, sizeof(struct line_array *));
+	if (!buckets)
+		return NULL;
 
-	/* create buckets */
-	buckets = (struct line_array **) xmalloc(NR_BUCKETS * sizeof(struct line_array *));
 	for (i = 0; i < NR_BUCKETS; i++)
-		buckets[i] = counts[i] > 0 ? line_array_create(counts[i], 1) : NULL;
+		if (counts[i] > 0 && !(buckets[i] = line_array_create(0, 1)))
+			goto err;
+
+	for (i = 0; i < NR_BUCKETS; i++) {
+		if (!buckets[i])
+			continue;
+
+		buckets[i]->lines = (struct line *) mem_alloc_huge(sizeof(struct line) * counts[i]);
+		if (!buckets[i]->lines)
+			goto err;
+
+		buckets[i]->capacity = counts[i];
+	}
 
 	/* populate buckets */
 	for (i = 0; i < larr->size; i++)
-		__line_array_add(buckets[(unsigned char) larr->lines[i].key[0]], &larr->lines[i]);
+		__line_array_add(buckets[__bucket(&larr->lines[i])], &larr->lines[i]);
 
 	return buckets;
+err:
+	for (i = 0; i < NR_BUCKETS; i++)
+		if (buckets[i])
+			line_array_free(buckets[i]);
+	xfree(buckets);
+	return NULL;
 }
 
 /**
- * @brief Sort a line array.
+ * @brief Reverse lines.
+ * 
+ * @param lines 		lines
+ * @param nr_lines		number of lines
+ */
+static void __reverse(struct line *lines, size_t nr_lines)
+{
+	struct line tmp;
+	size_t i, j;
+
+	for (i = 0, j = nr_lines - 1; i < j; i++, j--) {
+		tmp = lines[i];
+		lines[i] = lines[j];
+		lines[j] = tmp;
+	}
+}
+
+/**
+ * @brief Find natural runs (strictly descending runs are reversed).
+ * 
+ * @param larr 			line array
+ * @param runs 			runs start indexes (output, runs[nr_runs] = number of lines)
+ * @param max_runs 		maximum number of runs
+ *
+ * @return number of runs (0 if more than max_runs runs)
+ */
+static size_t __find_runs(struct line_array *larr, size_t *runs, size_t max_runs)
+{
+	struct line *lines = larr->lines;
+	size_t nr_runs = 0, i, j;
+
+	for (i = 0; i < larr->size; i = j) {
+		/* too many runs : input is not presorted */
+		if (nr_runs == max_runs)
+			return 0;
+
+		/* new run */
+		runs[nr_runs++] = i;
+		j = i + 1;
+		if (j == larr->size)
+			break;
+
+		/* descending run */
+		if (line_compare(&lines[j - 1], &lines[j]) > 0) {
+			while (j < larr->size && line_compare(&lines[j - 1], &lines[j]) > 0)
+				j++;
+
+			__reverse(lines + i, j - i);
+			continue;
+		}
+
+		/* ascending run */
+		while (j < larr->size && line_compare(&lines[j - 1], &lines[j]) <= 0)
+			j++;
+	}
+
+	runs[nr_runs] = larr->size;
+	return nr_runs;
+}
+
+/**
+ * @brief Merge 2 sorted runs.
+ * 
+ * @param src 			source lines
+ * @param dst 			destination lines
+ * @param start 		first run start
+ * @param mid 			second run start
+ * @param end 			second run end
+ */
+static void __merge_runs(struct line *src, struct line *dst, size_t start, size_t mid, size_t end)
+{
+	size_t i = start, j = mid, k = start;
+
+	/* runs already in order */
+	if (mid < end && line_compare(&src[mid - 1], &src[mid]) <= 0) {
+		memcpy(dst + start, src + start, sizeof(struct line) * (end - start));
+		return;
+	}
+
+	while (i < mid && j < end) {
+		if (line_compare(&src[j], &src[i]) < 0)
+			dst[k++] = src[j++];
+		else
+			dst[k++] = src[i++];
+	}
+
+	memcpy(dst + k, src + i, sizeof(struct line) * (mid - i));
+	k += mid - i;
+	memcpy(dst + k, src + j, sizeof(struct line) * (end - j));
+}
+
+/**
+ * @brief Merge pairs of runs (thread pool task).
+ * 
+ * @param arg 			thread argument
+ */
+static void __merge_thread(void *arg)
+{
+	struct thread_merge_arg *targ = (struct thread_merge_arg *) arg;
+	size_t i;
+
+	for (;;) {
+		/* get next pair of runs */
+		i = __atomic_fetch_add(&targ->i, 2, __ATOMIC_RELAXED);
+
+		/* no more runs */
+		if (i >= targ->nr_runs)
+			break;
+
+		/* merge runs (or copy last run) */
+		if (i + 1 < targ->nr_runs)
+			__merge_runs(targ->src, targ->dst, targ->runs[i], targ->runs[i + 1], targ->runs[i + 2]);
+		else
+			memcpy(targ->dst + targ->runs[i], targ->src + targ->runs[i], sizeof(struct line) * (targ->runs[i + 1] - targ->runs[i]));
+	}
+}
+
+/**
+ * @brief Sort a presorted line array, merging its natural runs.
+ * 
+ * @param larr			line array
+ * @param runs			runs start indexes
+ * @param nr_runs		number of runs
+ * @param nr_threads		number of threads to use
+ */
+static void __natural_merge_sort(struct line_array *larr, size_t *runs, size_t nr_runs, size_t nr_threads)
+{
+	struct thread_merge_arg targ;
+	struct line *tmp;
+	size_t i;
+
+	/* not enough memory to merge runs : sort in place */
+	tmp = (struct line *) mem_alloc_huge(sizeof(struct line) * larr->size);
+	if (!tmp) {
+		__qsort(larr->lines, larr->size);
+		return;
+	}
+
+	/* init threads arguments */
+	targ.src = larr->lines;
+	targ.dst = tmp;
+	targ.runs = runs;
+	targ.nr_runs = nr_runs;
+
+	/* merge pairs of runs until one run remains */
+	while (targ.nr_runs > 1) {
+		targ.i = 0;
+
+		/* merge on thread pool */
+		thread_pool_run(__merge_thread, &targ, nr_threads);
+
+		/* update runs */
+		for (i = 0; i < targ.nr_runs; i += 2)
+			targ.runs[i / 2] = targ.runs[i];
+		targ.runs[(targ.nr_runs + 1) / 2] = larr->size;
+		targ.nr_runs = (targ.nr_runs + 1) / 2;
+
+		/* swap buffers */
+		targ.dst = targ.src;
+		targ.src = targ.src == tmp ? larr->lines : tmp;
+	}
+
+	/* copy result */
+	if (targ.src == tmp)
+		memcpy(larr->lines, tmp, sizeof(struct line) * larr->size);
+
+	xfree(tmp);
+}
+
+/**
+ * @brief Sort a line array with buckets.
  * 
  * @param larr		line array
  * @param nr_threads	number of threads to use
  */
-void line_array_sort(struct line_array *larr, size_t nr_threads)
+static void __bucket_sort(struct line_array *larr, size_t nr_threads)
 {
-	pthread_t threads[nr_threads < 1 ? 1 : nr_threads];
 	struct thread_sort_arg targ;
 	size_t i, j, k;
 
-	/* fix number of threads */
-	if (nr_threads < 1)
-		nr_threads = 1;
-	
 	/* init threads arguments */
 	targ.buckets = __create_buckets(larr);
 	targ.i = 0;
-	pthread_mutex_init(&targ.lock, NULL);
-
-	/* create threads */
-	for (i = 0; i < nr_threads; i++)
-		pthread_create(&threads[i], NULL, __sort_thread, &targ);
-	
-	/* wait for threads */
-	for (i = 0; i < nr_threads; i++)
-		pthread_join(threads[i], NULL);
-	
+
+	/* not enough memory to copy lines in buckets : sort them in place in current thread */
+	if (!targ.buckets) {
+		__qsort(larr->lines, larr->size);
+		return;
+	}
+
+	/* sort buckets on thread pool */
+	thread_pool_run(__sort_thread, &targ, nr_threads);
+
 	/* merge buckets */
 	for (i = 0, k = 0; i < NR_BUCKETS; i++)
 		if (targ.buckets[i])
@@ -341,7 +1308,143 @@ void line_array_sort(struct line_array *larr, size_t nr_threads)
 		if (targ.buckets[i])
 			line_array_free(targ.buckets[i]);
 	xfree(targ.buckets);
-	pthread_mutex_destroy(&targ.lock);
+}
+
+/**
+ * @brief Sort a line array.
+ * 
+ * Presorted arrays (few natural runs) are detected in O(n) : already sorted arrays are left
+ * as is, otherwise their runs are merged. Other arrays are bucket sorted (buckets of short
+ * binary records keys are radix sorted).
+ * 
+ * @param larr		line array
+ * @param nr_threads	number of threads to use
+ */
+void line_array_sort(struct line_array *larr, size_t nr_threads)
+{
+	size_t *runs, max_runs, nr_runs;
+
+	/* fix number of threads */
+	if (nr_threads < 1)
+		nr_threads = 1;
+
+	/* nothing to sort */
+	if (larr->size < 2)
+		return;
+
+	/* find natural runs (not enough memory to keep them : input is taken as not presorted) */
+	max_runs = larr->size / MIN_RUN_LENGTH + 1;
+	runs = (size_t *) malloc(sizeof(size_t) * (max_runs + 1));
+	nr_runs = runs ? __find_runs(larr, runs, max_runs) : 0;
+
+	/* sort */
+	if (nr_runs > 1)
+		__natural_merge_sort(larr, runs, nr_runs, nr_threads);
+	else if (nr_runs == 0)
+		__bucket_sort(larr, nr_threads);
+
+	xfree(runs);
+}
+
+/**
+ * @brief Sift down a line in a max heap.
+ * 
+ * @param lines 		heap lines
+ * @param nr_lines		number of lines
+ * @param i 			line index
+ */
+static void __heap_sift_down(struct line *lines, size_t nr_lines, size_t i)
+{
+	struct line tmp;
+	size_t max, child;
+
+	for (;;) {
+		/* find max child */
+		max = i;
+		child = 2 * i + 1;
+		if (child < nr_lines && line_compare(&lines[child], &lines[max]) > 0)
+			max = child;
+		if (child + 1 < nr_lines && line_compare(&lines[child + 1], &lines[max]) > 0)
+			max = child + 1;
+
+		/* heap property satisfied */
+		if (max == i)
+			break;
+
+		tmp = lines[i];
+		lines[i] = lines[max];
+		lines[max] = tmp;
+		i = max;
+	}
+}
+
+/**
+ * @brief Push a line in a max heap.
+ * 
+ * @param heap			heap
+ * @param line			line
+ */
+void line_heap_push(struct line_array *heap, struct line *line)
+{
+	struct line tmp;
+	size_t i, parent;
+
+	/* add line */
+	__line_array_add(heap, line);
+
+	/* sift up */
+	for (i = heap->size - 1; i > 0; i = parent) {
+		parent = (i - 1) / 2;
+		if (line_compare(&heap->lines[parent], &heap->lines[i]) >= 0)
+			break;
+
+		tmp = heap->lines[i];
+		heap->lines[i] = heap->lines[parent];
+		heap->lines[parent] = tmp;
+	}
+}
+
+/**
+ * @brief Replace top (maximum) line of a max heap.
+ * 
+ * @param heap			heap
+ * @param line			line
+ */
+void line_heap_replace_top(struct line_array *heap, struct line *line)
+{
+	heap->lines[0] = *line;
+	__heap_sift_down(heap->lines, heap->size, 0);
+}
+
+/**
+ * @brief Keep and sort the first lines of a line array (bounded heap selection).
+ * 
+ * @param larr		line array
+ * @param limit		number of lines to keep
+ * @param nr_threads	number of threads to use
+ */
+void line_array_limit(struct line_array *larr, size_t limit, size_t nr_threads)
+{
+	size_t i;
+
+	if (limit < larr->size) {
+		/* build a max heap with first lines */
+		for (i = limit / 2; i > 0; i--)
+			__heap_sift_down(larr->lines, limit, i - 1);
+
+		/* keep lines lower than heap maximum */
+		for (i = limit; i < larr->size; i++) {
+			if (limit && line_compare(&larr->lines[i], &larr->lines[0]) < 0) {
+				larr->lines[0] = larr->lines[i];
+				__heap_sift_down(larr->lines, limit, 0);
+			}
+		}
+
+		larr->size = limit;
+	}
+
+	/* sort lines */
+	line_array_sort(larr, nr_threads);
 }
 
 /**
@@ -359,10 +1462,214 @@ int line_array_write(struct line_array *larr, FILE *fp)
 	/* write chunk */
 	for (i = 0; i < larr->size; i++) {
 		if (fwrite(larr->lines[i].value, larr->lines[i].value_len, 1, fp) != 1) {
-			fprintf(stderr, "Can't write line array\n");
+			xerror("Can't write line array\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Write a buffer at an offset (short writes are retried).
+ * 
+ * @param fd			output file descriptor
+ * @param buf			buffer
+ * @param len			buffer length
+ * @param offset		file offset
+ *
+ * @return status
+ */
+static int __pwrite_full(int fd, const char *buf, size_t len, off_t offset)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(fd, buf, len, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
 			return -1;
+
+		buf += n;
+		len -= n;
+		offset += n;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Compute output sizes of slices (thread pool task).
+ * 
+ * @param arg 			thread argument
+ */
+static void __size_thread(void *arg)
+{
+	struct thread_pwrite_arg *targ = (struct thread_pwrite_arg *) arg;
+	struct line_array *larr = targ->larr;
+	size_t i, j, end;
+	off_t size;
+
+	for (;;) {
+		/* get next slice */
+		i = __atomic_fetch_add(&targ->i, 1, __ATOMIC_RELAXED);
+		if (i >= targ->nr_slices)
+			break;
+
+		size = 0;
+		end = (i + 1) * larr->size / targ->nr_slices;
+		for (j = i * larr->size / targ->nr_slices; j < end; j++)
+			size += larr->lines[j].value_len;
+
+		targ->offsets[i + 1] = size;
+	}
+}
+
+/**
+ * @brief Write slices at their offsets (thread pool task).
+ * 
+ * @param arg 			thread argument
+ */
+static void __pwrite_thread(void *arg)
+{
+	struct thread_pwrite_arg *targ = (struct thread_pwrite_arg *) arg;
+	struct line_array *larr = targ->larr;
+	size_t i, j, end, len;
+	struct line *line;
+	off_t offset;
+	char *buf;
+
+	buf = (char *) malloc(PWRITE_BUF_SIZE);
+	if (!buf) {
+		__atomic_store_n(&targ->ret, -1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	for (;;) {
+		/* get next slice */
+		i = __atomic_fetch_add(&targ->i, 1, __ATOMIC_RELAXED);
+		if (i >= targ->nr_slices)
+			break;
+
+		/* copy lines in buffer, write it when full (long lines are written directly) */
+		offset = targ->offsets[i];
+		end = (i + 1) * larr->size / targ->nr_slices;
+		for (j = i * larr->size / targ->nr_slices, len = 0; j < end; j++) {
+			line = &larr->lines[j];
+			if (len + line->value_len > PWRITE_BUF_SIZE) {
+				if (__pwrite_full(targ->fd, buf, len, offset))
+					goto err;
+				offset += len;
+				len = 0;
+			}
+
+			if (line->value_len > PWRITE_BUF_SIZE) {
+				if (__pwrite_full(targ->fd, line->value, line->value_len, offset))
+					goto err;
+				offset += line->value_len;
+				continue;
+			}
+
+			memcpy(buf + len, line->value, line->value_len);
+			len += line->value_len;
 		}
+
+		if (__pwrite_full(targ->fd, buf, len, offset))
+			goto err;
+	}
+
+	free(buf);
+	return;
+err:
+	__atomic_store_n(&targ->ret, -1, __ATOMIC_RELAXED);
+	free(buf);
+}
+
+/**
+ * @brief Write a line array in a file with several threads : sorted lines are cut in slices, a prefix sum of
+ * slices sizes gives their offsets, then slices are written concurrently (pwrite) in the preallocated file.
+ * 
+ * @param larr			line array
+ * @param fd			output file descriptor (regular file)
+ * @param offset		file offset of first line
+ * @param nr_threads		number of threads to use
+ *
+ * @return status
+ */
+int line_array_pwrite(struct line_array *larr, int fd, off_t offset, size_t nr_threads)
+{
+	struct thread_pwrite_arg targ;
+	size_t i;
+
+	if (larr->size == 0)
+		return 0;
+
+	targ.larr = larr;
+	targ.fd = fd;
+	targ.nr_slices = (nr_threads < 1 ? 1 : nr_threads) * PWRITE_SLICES_PER_THREAD;
+	if (targ.nr_slices > larr->size)
+		targ.nr_slices = larr->size;
+	targ.ret = 0;
+	targ.offsets = (off_t *) malloc(sizeof(off_t) * (targ.nr_slices + 1));
+	if (!targ.offsets) {
+		xerror("Can't write line array\n");
+		return -1;
+	}
+
+	/* compute slices sizes */
+	targ.i = 0;
+	thread_pool_run(__size_thread, &targ, nr_threads);
+
+	/* prefix sum : slices offsets */
+	targ.offsets[0] = offset;
+	for (i = 0; i < targ.nr_slices; i++)
+		targ.offsets[i + 1] += targ.offsets[i];
+
+	/* preallocate output file (optional, pwrite extends it anyway) */
+	if (targ.offsets[targ.nr_slices] > offset)
+		fallocate(fd, 0, offset, targ.offsets[targ.nr_slices] - offset);
+
+	/* write slices */
+	targ.i = 0;
+	thread_pool_run(__pwrite_thread, &targ, nr_threads);
+
+	xfree(targ.offsets);
+
+	if (targ.ret)
+		xerror("Can't write line array\n");
+
+	return targ.ret;
+}
+
+/**
+ * @brief Write a line array as a spilled run (records carry sort keys when they are not in lines).
+ * 
+ * @param larr			line array
+ * @param fp			output file
+ *
+ * @return status
+ */
+int line_array_write_records(struct line_array *larr, FILE *fp)
+{
+	struct line *line;
+	size_t i;
+
+	/* plain lines */
+	if (!KEYS_OUT_OF_LINE)
+		return line_array_write(larr, fp);
+
+	/* sort key, record delimiter then line */
+	for (i = 0; i < larr->size; i++) {
+		line = &larr->lines[i];
+		if (line->key_len > 0 && fwrite(line->key, line->key_len, 1, fp) != 1)
+			goto err;
+		if (fputc(RECORD_DELIM, fp) == EOF || fwrite(line->value, line->value_len, 1, fp) != 1)
+			goto err;
 	}
 
 	return 0;
+err:
+	xerror("Can't write line array\n");
+	return -1;
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define _LINE_H_
 
 #include <stdio.h>
+#include <sys/types.h>
 
 /**
  * @brief Line structure.
@@ -22,8 +23,83 @@ struct line_array {
 	size_t			size;
 	size_t			capacity;
 	char			grow_slow;
+	char *			keys;
+	size_t			keys_len;
+	size_t			keys_capacity;
+	size_t			max_memory;
+	char			full;
 };
 
+/**
+ * @brief Key options (sort keys are computed once per line).
+ */
+#define LINE_KEY_COLLATE		0x1	/* LC_COLLATE order */
+#define LINE_KEY_FOLD			0x2	/* ignore case */
+#define LINE_KEY_TRIM			0x4	/* ignore leading and trailing blanks */
+#define LINE_KEY_BLANKS			0x8	/* ignore leading blanks */
+#define LINE_KEY_CSV			0x10	/* quoted CSV fields (delimiters and newlines in double quotes) */
+#define LINE_KEY_TAG			0x20	/* lines are tags : sort key, input offset and length */
+
+/**
+ * @brief Set key options.
+ * 
+ * @param flags			key options (LINE_KEY_*)
+ */
+void line_set_key_flags(int flags);
+
+/**
+ * @brief Get key options.
+ * 
+ * @return key options (LINE_KEY_*)
+ */
+int line_get_key_flags();
+
+/**
+ * @brief Set fixed size binary records mode (records are not parsed : key is at a fixed offset).
+ * 
+ * @param record_size		record size (0 = newline terminated text lines)
+ * @param key_off		key offset in record
+ * @param key_len		key length
+ */
+void line_set_record_size(size_t record_size, size_t key_off, size_t key_len);
+
+/**
+ * @brief Get record size.
+ * 
+ * @return record size (0 = newline terminated text lines)
+ */
+size_t line_get_record_size();
+
+/**
+ * @brief Get record key position.
+ * 
+ * @param key_off		key offset in record (output)
+ * @param key_len		key length (output)
+ */
+void line_get_record_key(size_t *key_off, size_t *key_len);
+
+/**
+ * @brief Get sort key size of a line (memory needed per line when sort keys are stored out of lines).
+ * 
+ * @param value 		line value
+ * @param value_len		value length
+ * @param field_delim 		field delimiter
+ * @param key_field 		key field
+ *
+ * @return sort key size (0 if keys are compared in place)
+ */
+size_t line_key_size(char *value, int value_len, char field_delim, int key_field);
+
+/**
+ * @brief Find end of a line with quoted CSV fields (newlines in quotes don't end the line).
+ * 
+ * @param s			line start (in a null terminated buffer)
+ * @param record		spilled run record (sort key before line is skipped) ?
+ *
+ * @return end of line (newline, or null byte if line is not complete)
+ */
+char *line_csv_end(char *s, int record);
+
 /**
  * @brief Init a line.
  * 
@@ -35,6 +111,27 @@ struct line_array {
  */
 void line_init(struct line *line, char *value, int value_len, char field_delim, int key_field);
 
+/**
+ * @brief Init a line from a spilled run record (sort key is carried before the line when it is not in the line).
+ * 
+ * @param line			line
+ * @param record 		record
+ * @param record_len		record length
+ * @param field_delim 		field delimiter
+ * @param key_field 		key field
+ */
+void line_init_record(struct line *line, char *record, int record_len, char field_delim, int key_field);
+
+/**
+ * @brief Duplicate a line (value and sort key are copied in a single allocation).
+ * 
+ * @param dst 			destination line
+ * @param src 			source line
+ *
+ * @return status (-1 if memory can't be allocated)
+ */
+int line_dup(struct line *dst, const struct line *src);
+
 /**
  * @brief Compare 2 lines.
  * 
@@ -51,7 +148,7 @@ int line_compare(const struct line *line1, const struct line *line2);
  * @param capacity	initial capacity
  * @param grow_slow	grow slow ?
  * 
- * @return line array
+ * @return line array (NULL if memory can't be allocated)
  */
 struct line_array *line_array_create(size_t capacity, char grow_slow);
 
@@ -77,8 +174,66 @@ void line_array_clear_full(struct line_array *larr);
  * @param value_len	line value length
  * @param field_delim	field delimiter
  * @param key_field 	key field
+ *
+ * @return status (-1 = line array is full, line is not added)
+ */
+int line_array_add(struct line_array *larr, char *value, size_t value_len, char field_delim, int key_field);
+
+/**
+ * @brief Add a line which is its own key (partition splitters : no field or record key offset).
+ * 
+ * @param larr		line array
+ * @param value 	line value (and key)
+ * @param value_len	line value length
+ *
+ * @return status (-1 = line array is full, line is not added)
+ */
+int line_array_add_key(struct line_array *larr, char *value, size_t value_len);
+
+/**
+ * @brief Add a line as a tag (value is "input_offset length\n", sort key is copied, so line text can be dropped).
+ * 
+ * @param larr		line array
+ * @param value 	line value
+ * @param value_len	line value length
+ * @param off		line input offset
+ * @param field_delim	field delimiter
+ * @param key_field 	key field
+ *
+ * @return status (-1 = line array is full, line is not added)
  */
-void line_array_add(struct line_array *larr, char *value, size_t value_len, char field_delim, int key_field);
+int line_array_add_tag(struct line_array *larr, char *value, size_t value_len, off_t off, char field_delim, int key_field);
+
+/**
+ * @brief Parse a tag.
+ * 
+ * @param line		tag line
+ * @param len		line length (output)
+ *
+ * @return line input offset
+ */
+off_t line_tag_parse(const struct line *line, size_t *len);
+
+/**
+ * @brief Add a line from a spilled run record.
+ * 
+ * @param larr		line array
+ * @param record 	record
+ * @param record_len	record length
+ * @param field_delim	field delimiter
+ * @param key_field 	key field
+ *
+ * @return status (-1 = line array is full, line is not added)
+ */
+int line_array_add_record(struct line_array *larr, char *record, size_t record_len, char field_delim, int key_field);
+
+/**
+ * @brief Add an already parsed line.
+ * 
+ * @param larr			line array
+ * @param line			line to add
+ */
+void line_array_add_line(struct line_array *larr, struct line *line);
 
 /**
  * @brief Sort a line array.
@@ -88,6 +243,31 @@ void line_array_add(struct line_array *larr, char *value, size_t value_len, char
  */
 void line_array_sort(struct line_array *larr, size_t nr_threads);
 
+/**
+ * @brief Keep and sort the first lines of a line array (bounded heap selection).
+ * 
+ * @param larr		line array
+ * @param limit		number of lines to keep
+ * @param nr_threads	number of threads to use
+ */
+void line_array_limit(struct line_array *larr, size_t limit, size_t nr_threads);
+
+/**
+ * @brief Push a line in a max heap.
+ * 
+ * @param heap			heap
+ * @param line			line
+ */
+void line_heap_push(struct line_array *heap, struct line *line);
+
+/**
+ * @brief Replace top (maximum) line of a max heap.
+ * 
+ * @param heap			heap
+ * @param line			line
+ */
+void line_heap_replace_top(struct line_array *heap, struct line *line);
+
 /**
  * @brief Write a line array on disk.
  * 
@@ -98,4 +278,27 @@ void line_array_sort(struct line_array *larr, size_t nr_threads);
  */
 int line_array_write(struct line_array *larr, FILE *fp);
 
+/**
+ * @brief Write a line array in a file with several threads : sorted lines are cut in slices, a prefix sum of
+ * slices sizes gives their offsets, then slices are written concurrently (pwrite) in the preallocated file.
+ * 
+ * @param larr			line array
+ * @param fd			output file descriptor (regular file)
+ * @param offset		file offset of first line
+ * @param nr_threads		number of threads to use
+ *
+ * @return status
+ */
+int line_array_pwrite(struct line_array *larr, int fd, off_t offset, size_t nr_threads);
+
+/**
+ * @brief Write a line array as a spilled run (records carry sort keys when they are not in lines).
+ * 
+ * @param larr			line array
+ * @param fp			output file
+ *
+ * @return status
+ */
+int line_array_write_records(struct line_array *larr, FILE *fp);
+
 #endif
\ No newline at end of file
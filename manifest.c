@@ -0,0 +1,236 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "manifest.h"
+#include "mem.h"
+
+#define MANIFEST_FILE		"manifest"
+#define MANIFEST_TMP_FILE	"manifest.tmp"
+
+/**
+ * @brief Sync a directory (make created and renamed files durable).
+ * 
+ * @param dir			directory
+ *
+ * @return status
+ */
+static int __sync_dir(const char *dir)
+{
+	int fd, ret;
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return -1;
+
+	ret = fsync(fd);
+	close(fd);
+
+	return ret;
+}
+
+/**
+ * @brief Load runs of an existing manifest in a new manifest (runs are kept while they are complete).
+ * 
+ * @param m			manifest
+ * @param fp_old		existing manifest
+ * @param fp_new		new manifest
+ * @param input_id		input identity
+ *
+ * @return status (-1 if existing manifest belongs to another input)
+ */
+static int __load_runs(struct manifest *m, FILE *fp_old, FILE *fp_new, const char *input_id)
+{
+	size_t len = 0, i, size, nr_lines;
+	char *line = NULL, path[4096];
+	long long input_off;
+	struct stat st;
+	ssize_t n;
+	int ret = 0;
+
+	/* empty manifest (crashed while created) */
+	n = getline(&line, &len, fp_old);
+	if (n <= 0 || line[n - 1] != '\n')
+		goto out;
+
+	/* another input or other options */
+	if (strncmp(line, "input ", 6) || strlen(input_id) != (size_t) n - 7 || strncmp(line + 6, input_id, n - 7)) {
+		ret = -1;
+		goto out;
+	}
+
+	/* keep complete runs */
+	while ((n = getline(&line, &len, fp_old)) > 0 && line[n - 1] == '\n') {
+		if (sscanf(line, "run %zu %lld %zu %zu", &i, &input_off, &size, &nr_lines) != 4 || i != m->nr_runs)
+			break;
+
+		manifest_run_path(m, i, path, sizeof(path));
+		if (stat(path, &st) || (size_t) st.st_size != size)
+			break;
+
+		fputs(line, fp_new);
+		m->nr_runs++;
+		m->input_off = input_off;
+	}
+out:
+	xfree(line);
+	return ret;
+}
+
+/**
+ * @brief Open a manifest (runs recorded by a previous sort of the same input are kept).
+ * 
+ * @param dir			work directory (created if needed)
+ * @param input_id		input identity (input file, size, modification time and sort options)
+ * 
+ * @return manifest
+ */
+struct manifest *manifest_open(const char *dir, const char *input_id)
+{
+	char path[4096], tmp_path[4096];
+	FILE *fp_old = NULL, *fp_new = NULL;
+	struct manifest *m;
+
+	/* allocate manifest */
+	m = (struct manifest *) xmalloc(sizeof(struct manifest));
+	m->dir = xstrdup(dir);
+	m->fp = NULL;
+	m->nr_runs = 0;
+	m->input_off = 0;
+
+	/* create work directory */
+	if (mkdir(dir, 0700) && errno != EEXIST) {
+		fprintf(stderr, "Can't create work directory \"%s\"\n", dir);
+		goto err;
+	}
+
+	/* write a new manifest */
+	snprintf(path, sizeof(path), "%s/" MANIFEST_FILE, dir);
+	snprintf(tmp_path, sizeof(tmp_path), "%s/" MANIFEST_TMP_FILE, dir);
+	fp_new = fopen(tmp_path, "w");
+	if (!fp_new) {
+		fprintf(stderr, "Can't create manifest \"%s\"\n", tmp_path);
+		goto err;
+	}
+	fprintf(fp_new, "input %s\n", input_id);
+
+	/* keep runs of existing manifest */
+	fp_old = fopen(path, "r");
+	if (fp_old && __load_runs(m, fp_old, fp_new, input_id)) {
+		fprintf(stderr, "Work directory \"%s\" belongs to another sort\n", dir);
+		goto err;
+	}
+
+	/* replace manifest */
+	if (fflush(fp_new) || fdatasync(fileno(fp_new)) || rename(tmp_path, path) || __sync_dir(dir)) {
+		fprintf(stderr, "Can't write manifest \"%s\"\n", path);
+		goto err;
+	}
+
+	/* runs are appended */
+	m->fp = fopen(path, "a");
+	if (!m->fp) {
+		fprintf(stderr, "Can't open manifest \"%s\"\n", path);
+		goto err;
+	}
+
+	goto out;
+err:
+	manifest_free(m);
+	m = NULL;
+out:
+	if (fp_old)
+		fclose(fp_old);
+	if (fp_new)
+		fclose(fp_new);
+
+	return m;
+}
+
+/**
+ * @brief Free a manifest (runs and manifest are kept on disk).
+ * 
+ * @param m			manifest
+ */
+void manifest_free(struct manifest *m)
+{
+	if (!m)
+		return;
+
+	if (m->fp)
+		fclose(m->fp);
+
+	xfree(m->dir);
+	free(m);
+}
+
+/**
+ * @brief Get path of a run.
+ * 
+ * @param m			manifest
+ * @param i			run index
+ * @param path			path (output)
+ * @param len			path buffer length
+ */
+void manifest_run_path(struct manifest *m, size_t i, char *path, size_t len)
+{
+	snprintf(path, len, "%s/run.%zu", m->dir, i);
+}
+
+/**
+ * @brief Record next run (once written and synced).
+ * 
+ * @param m			manifest
+ * @param input_off		input offset after run lines
+ * @param nr_lines		number of lines of run
+ * 
+ * @return status
+ */
+int manifest_add_run(struct manifest *m, off_t input_off, size_t nr_lines)
+{
+	char path[4096];
+	struct stat st;
+
+	/* run file must be durable before it is recorded */
+	manifest_run_path(m, m->nr_runs, path, sizeof(path));
+	if (stat(path, &st) || __sync_dir(m->dir))
+		goto err;
+
+	/* append run */
+	fprintf(m->fp, "run %zu %lld %zu %zu\n", m->nr_runs, (long long) input_off, (size_t) st.st_size, nr_lines);
+	if (fflush(m->fp) || fdatasync(fileno(m->fp)))
+		goto err;
+
+	m->nr_runs++;
+	m->input_off = input_off;
+	return 0;
+err:
+	fprintf(stderr, "Can't record run \"%s\"\n", path);
+	return -1;
+}
+
+/**
+ * @brief Remove runs, manifest and work directory (sort is complete).
+ * 
+ * @param m			manifest
+ */
+void manifest_remove(struct manifest *m)
+{
+	char path[4096];
+	size_t i;
+
+	/* recorded runs, then runs written after last record (if any) */
+	for (i = 0; ; i++) {
+		manifest_run_path(m, i, path, sizeof(path));
+		if (unlink(path) && i >= m->nr_runs)
+			break;
+	}
+
+	snprintf(path, sizeof(path), "%s/" MANIFEST_FILE, m->dir);
+	unlink(path);
+	rmdir(m->dir);
+}
\ No newline at end of file
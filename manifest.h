@@ -0,0 +1,62 @@
+#ifndef _MANIFEST_H_
+#define _MANIFEST_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/**
+ * @brief Resumable sort manifest (spilled runs are named files "work_dir/run.i").
+ */
+struct manifest {
+	char *			dir;
+	FILE *			fp;
+	size_t			nr_runs;
+	off_t			input_off;
+};
+
+/**
+ * @brief Open a manifest (runs recorded by a previous sort of the same input are kept).
+ * 
+ * @param dir			work directory (created if needed)
+ * @param input_id		input identity (input file, size, modification time and sort options)
+ * 
+ * @return manifest
+ */
+struct manifest *manifest_open(const char *dir, const char *input_id);
+
+/**
+ * @brief Free a manifest (runs and manifest are kept on disk).
+ * 
+ * @param m			manifest
+ */
+void manifest_free(struct manifest *m);
+
+/**
+ * @brief Get path of a run.
+ * 
+ * @param m			manifest
+ * @param i			run index
+ * @param path			path (output)
+ * @param len			path buffer length
+ */
+void manifest_run_path(struct manifest *m, size_t i, char *path, size_t len);
+
+/**
+ * @brief Record next run (once written and synced).
+ * 
+ * @param m			manifest
+ * @param input_off		input offset after run lines
+ * @param nr_lines		number of lines of run
+ * 
+ * @return status
+ */
+int manifest_add_run(struct manifest *m, off_t input_off, size_t nr_lines);
+
+/**
+ * @brief Remove runs, manifest and work directory (sort is complete).
+ * 
+ * @param m			manifest
+ */
+void manifest_remove(struct manifest *m);
+
+#endif
\ No newline at end of file
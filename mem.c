@@ -1,9 +1,24 @@
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <err.h>
 
 #include "mem.h"
 
+#define CGROUP_NO_LIMIT			(1LL << 60)
+#define HUGE_PAGE_SIZE			(2UL << 20)
+#define THP_ENABLED			"/sys/kernel/mm/transparent_hugepage/enabled"
+
+/* don't print errors (library callers only get status codes) ? */
+static int mem_quiet = 0;
+
+/* transparent huge pages can be asked for (-1 = not checked yet) */
+static int mem_thp = -1;
+
 /**
  * @brief Malloc or exit.
  * 
@@ -64,4 +79,225 @@ char *xstrdup(const char *s)
 		err(2, NULL);
 
 	return r;
+}
+
+/**
+ * @brief Check if transparent huge pages can be asked for (enabled mode is "always" or "madvise").
+ * 
+ * @return 1 if huge pages can be used, 0 otherwise
+ */
+static int __thp_available()
+{
+	char line[256];
+	FILE *fp;
+
+	if (mem_thp >= 0)
+		return mem_thp;
+
+	mem_thp = 0;
+#ifdef MADV_HUGEPAGE
+	fp = fopen(THP_ENABLED, "r");
+	if (fp) {
+		if (fgets(line, sizeof(line), fp) && !strstr(line, "[never]"))
+			mem_thp = 1;
+		fclose(fp);
+	}
+#else
+	(void) line;
+	(void) fp;
+#endif
+
+	return mem_thp;
+}
+
+/**
+ * @brief Ask for transparent huge pages on a large allocation (whole 2 MB pages of it, no-op on small ones).
+ * 
+ * @param ptr		memory
+ * @param size		memory size
+ */
+void mem_advise_huge(void *ptr, size_t size)
+{
+	uintptr_t start, end;
+
+	if (!ptr || size < HUGE_PAGE_SIZE || !__thp_available())
+		return;
+
+	start = ((uintptr_t) ptr + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+	end = ((uintptr_t) ptr + size) & ~(HUGE_PAGE_SIZE - 1);
+#ifdef MADV_HUGEPAGE
+	if (start < end)
+		madvise((void *) start, end - start, MADV_HUGEPAGE);
+#endif
+}
+
+/**
+ * @brief Malloc a large buffer on 2 MB boundaries backed by transparent huge pages (normal pages if
+ * they are not available, unaligned under an address space limit). Memory is freed or reallocated as usual.
+ * 
+ * @param size 		size to allocate
+ *
+ * @return allocated memory (NULL if there's not enough memory)
+ */
+void *mem_alloc_huge(size_t size)
+{
+	struct rlimit rlim;
+	void *ptr;
+
+	/* small allocation or no huge pages */
+	if (size < HUGE_PAGE_SIZE || !__thp_available())
+		return malloc(size);
+
+	/* aligned allocation wastes up to 2 MB of address space : under a limit (-S), only whole huge pages inside buffer are used */
+	if (getrlimit(RLIMIT_AS, &rlim) || rlim.rlim_cur != RLIM_INFINITY || posix_memalign(&ptr, HUGE_PAGE_SIZE, size))
+		ptr = malloc(size);
+
+	mem_advise_huge(ptr, size);
+	return ptr;
+}
+
+/**
+ * @brief Print an error on standard error (unless errors are quiet).
+ * 
+ * @param fmt 		format
+ */
+void xerror(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (mem_quiet)
+		return;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+/**
+ * @brief Set errors mode (process wide).
+ * 
+ * @param quiet 	don't print errors (callers only get status codes) ?
+ */
+void xerror_set_quiet(int quiet)
+{
+	mem_quiet = quiet;
+}
+
+/**
+ * @brief Get errors mode.
+ * 
+ * @return 1 if errors are not printed
+ */
+int xerror_get_quiet()
+{
+	return mem_quiet;
+}
+
+/**
+ * @brief Read a value of a cgroup file.
+ * 
+ * @param dir		cgroup directory
+ * @param file		cgroup file
+ * @param key		key of value ("key value" lines, NULL = first value of file)
+ *
+ * @return value (-1 = no value or no limit)
+ */
+static long long __cgroup_read(const char *dir, const char *file, const char *key)
+{
+	char path[4096], line[256];
+	long long value = -1;
+	size_t key_len;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+
+	key_len = key ? strlen(key) : 0;
+	while (fgets(line, sizeof(line), fp)) {
+		if (!key) {
+			value = strtoll(line, NULL, 10);
+			break;
+		}
+
+		if (!strncmp(line, key, key_len) && line[key_len] == ' ') {
+			value = strtoll(line + key_len + 1, NULL, 10);
+			break;
+		}
+	}
+
+	fclose(fp);
+	return value;
+}
+
+/**
+ * @brief Find memory cgroup directory of the process.
+ * 
+ * @param dir		cgroup directory (output)
+ * @param size		cgroup directory size
+ *
+ * @return cgroup version (0 = no memory cgroup)
+ */
+static int __cgroup_dir(char *dir, size_t size)
+{
+	char line[4096], *path;
+	int version = 0;
+	FILE *fp;
+
+	fp = fopen("/proc/self/cgroup", "r");
+	if (!fp)
+		return 0;
+
+	/* cgroup v1 memory controller or cgroup v2 unified hierarchy */
+	while (!version && fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\n")] = 0;
+		if ((path = strstr(line, ":memory:")) != NULL && snprintf(dir, size, "/sys/fs/cgroup/memory%s", path + 8) < (int) size)
+			version = 1;
+		else if (!strncmp(line, "0::", 3) && snprintf(dir, size, "/sys/fs/cgroup%s", line + 3) < (int) size)
+			version = 2;
+	}
+
+	fclose(fp);
+
+	/* cgroup namespace : process cgroup is mounted as root */
+	if (version && access(dir, F_OK))
+		snprintf(dir, size, version == 1 ? "/sys/fs/cgroup/memory" : "/sys/fs/cgroup");
+
+	return version;
+}
+
+/**
+ * @brief Get memory left to the process by its memory cgroup (limit minus usage, reclaimable page cache excluded).
+ * 
+ * @return available memory (-1 = no memory limit)
+ */
+ssize_t mem_available()
+{
+	long long limit, usage, cache;
+	char dir[4096];
+
+	switch (__cgroup_dir(dir, sizeof(dir))) {
+	case 1:
+		limit = __cgroup_read(dir, "memory.limit_in_bytes", NULL);
+		usage = __cgroup_read(dir, "memory.usage_in_bytes", NULL);
+		cache = __cgroup_read(dir, "memory.stat", "total_inactive_file");
+		break;
+	case 2:
+		limit = __cgroup_read(dir, "memory.max", NULL);
+		usage = __cgroup_read(dir, "memory.current", NULL);
+		cache = __cgroup_read(dir, "memory.stat", "inactive_file");
+		break;
+	default:
+		return -1;
+	}
+
+	/* no limit ("max" or page counter maximum) */
+	if (limit <= 0 || limit >= CGROUP_NO_LIMIT || usage < 0)
+		return -1;
+
+	if (cache > 0 && cache < usage)
+		usage -= cache;
+
+	return usage < limit ? limit - usage : 0;
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define _MEM_H_
 
 #include <stdio.h>
+#include <sys/types.h>
 
 /**
  * @brief Malloc or exit.
@@ -38,4 +39,50 @@ void xfree(void *ptr);
  */
 char *xstrdup(const char *s);
 
+/**
+ * @brief Ask for transparent huge pages on a large allocation (whole 2 MB pages of it, no-op on small ones).
+ * 
+ * @param ptr		memory
+ * @param size		memory size
+ */
+void mem_advise_huge(void *ptr, size_t size);
+
+/**
+ * @brief Malloc a large buffer on 2 MB boundaries backed by transparent huge pages (normal pages if
+ * they are not available, unaligned under an address space limit). Memory is freed or reallocated as usual.
+ * 
+ * @param size 		size to allocate
+ *
+ * @return allocated memory (NULL if there's not enough memory)
+ */
+void *mem_alloc_huge(size_t size);
+
+/**
+ * @brief Print an error on standard error (unless errors are quiet).
+ * 
+ * @param fmt 		format
+ */
+void xerror(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * @brief Set errors mode (process wide).
+ * 
+ * @param quiet 	don't print errors (callers only get status codes) ?
+ */
+void xerror_set_quiet(int quiet);
+
+/**
+ * @brief Get errors mode.
+ * 
+ * @return 1 if errors are not printed
+ */
+int xerror_get_quiet();
+
+/**
+ * @brief Get memory left to the process by its memory cgroup (limit minus usage, reclaimable page cache excluded).
+ * 
+ * @return available memory (-1 = no memory limit)
+ */
+ssize_t mem_available();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,263 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+#include "numa.h"
+
+#define NUMA_SYSFS			"/sys/devices/system/node"
+#define NUMA_MAX_NODES			1024
+#define NUMA_MOVE_BATCH			512
+
+/* memory policy (numaif.h values, no libnuma needed) */
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE			3
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE			(1 << 1)
+#endif
+
+/* online nodes (process wide, NUMA mode is only enabled with 2 nodes or more) */
+static unsigned long numa_nodes[NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+static size_t numa_nr_nodes = 0;
+static int numa_on = 0;
+
+/* placements (in pages) */
+static size_t numa_local = 0;
+static size_t numa_moved = 0;
+static size_t numa_remote = 0;
+
+/**
+ * @brief Parse a sysfs list ("0-3,8,10-11") and call a function on each value.
+ *
+ * @param path			sysfs file
+ * @param fn			function called on each value
+ * @param arg			function argument
+ *
+ * @return status
+ */
+static int __parse_list(const char *path, void (*fn)(long, void *), void *arg)
+{
+	char line[4096], *s, *end;
+	long first, last;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+
+	if (!fgets(line, sizeof(line), fp)) {
+		fclose(fp);
+		return -1;
+	}
+
+	fclose(fp);
+
+	for (s = line; *s && *s != '\n'; s = *end ? end + 1 : end) {
+		first = last = strtol(s, &end, 10);
+		if (end == s)
+			return -1;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+
+		for (; first <= last; first++)
+			fn(first, arg);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Add an online node.
+ *
+ * @param node			node
+ * @param arg			unused
+ */
+static void __add_node(long node, void *arg)
+{
+	(void) arg;
+
+	if (node < 0 || node >= NUMA_MAX_NODES)
+		return;
+
+	numa_nodes[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+	numa_nr_nodes++;
+}
+
+/**
+ * @brief Add a CPU to a set.
+ *
+ * @param cpu			CPU
+ * @param arg			CPU set
+ */
+static void __add_cpu(long cpu, void *arg)
+{
+	if (cpu >= 0 && cpu < CPU_SETSIZE)
+		CPU_SET(cpu, (cpu_set_t *) arg);
+}
+
+/**
+ * @brief Enable NUMA mode (process wide, no-op on a single node machine).
+ *
+ * @return 1 if NUMA mode is enabled, 0 otherwise
+ */
+int numa_enable()
+{
+	memset(numa_nodes, 0, sizeof(numa_nodes));
+	numa_nr_nodes = 0;
+
+	if (__parse_list(NUMA_SYSFS "/online", __add_node, NULL))
+		numa_nr_nodes = 0;
+
+	numa_on = numa_nr_nodes > 1;
+	return numa_on;
+}
+
+/**
+ * @brief Is NUMA mode enabled ?
+ *
+ * @return 1 if NUMA mode is enabled, 0 otherwise
+ */
+int numa_enabled()
+{
+	return numa_on;
+}
+
+/**
+ * @brief Pin calling thread to the CPUs of a node (workers are spread over nodes).
+ *
+ * @param i			worker index (node is i modulo number of nodes)
+ *
+ * @return status
+ */
+int numa_pin(size_t i)
+{
+	cpu_set_t allowed, cpus;
+	char path[256];
+	long node;
+
+	if (!numa_on || sched_getaffinity(0, sizeof(allowed), &allowed))
+		return -1;
+
+	/* i-th online node */
+	i %= numa_nr_nodes;
+	for (node = 0; node < NUMA_MAX_NODES; node++)
+		if ((numa_nodes[node / (8 * sizeof(unsigned long))] & (1UL << (node % (8 * sizeof(unsigned long))))) && i-- == 0)
+			break;
+
+	/* CPUs of node allowed to the process */
+	CPU_ZERO(&cpus);
+	snprintf(path, sizeof(path), NUMA_SYSFS "/node%ld/cpulist", node);
+	if (__parse_list(path, __add_cpu, &cpus))
+		return -1;
+
+	CPU_AND(&cpus, &cpus, &allowed);
+	if (CPU_COUNT(&cpus) == 0)
+		return -1;
+
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) ? -1 : 0;
+}
+
+/**
+ * @brief Interleave pages of a memory range over all nodes (pages not touched yet only).
+ *
+ * @param addr			memory range
+ * @param len			memory range length
+ */
+void numa_interleave(void *addr, size_t len)
+{
+	uintptr_t page_size = sysconf(_SC_PAGESIZE), start, end;
+
+	if (!numa_on)
+		return;
+
+	/* whole pages of range */
+	start = ((uintptr_t) addr + page_size - 1) & ~(page_size - 1);
+	end = ((uintptr_t) addr + len) & ~(page_size - 1);
+	if (start >= end)
+		return;
+
+	syscall(SYS_mbind, start, end - start, MPOL_INTERLEAVE, numa_nodes, NUMA_MAX_NODES, 0);
+}
+
+/**
+ * @brief Move pages of a memory range to the node of calling thread and count placements.
+ *
+ * @param addr			memory range
+ * @param len			memory range length
+ */
+void numa_place(void *addr, size_t len)
+{
+	uintptr_t page_size = sysconf(_SC_PAGESIZE), page, end;
+	int nodes[NUMA_MOVE_BATCH], status[NUMA_MOVE_BATCH];
+	void *pages[NUMA_MOVE_BATCH];
+	size_t local = 0, moved = 0, remote = 0, nr_pages, n, i;
+	unsigned int cpu, node;
+
+	if (!numa_on || len == 0 || syscall(SYS_getcpu, &cpu, &node, NULL))
+		return;
+
+	page = (uintptr_t) addr & ~(page_size - 1);
+	end = (uintptr_t) addr + len;
+
+	while (page < end) {
+		/* next batch of pages */
+		for (n = 0; n < NUMA_MOVE_BATCH && page < end; n++, page += page_size) {
+			pages[n] = (void *) page;
+			nodes[n] = node;
+		}
+
+		/* find pages nodes */
+		if (syscall(SYS_move_pages, 0, n, pages, NULL, status, 0)) {
+			remote += n;
+			continue;
+		}
+
+		/* keep remote pages only */
+		for (i = 0, nr_pages = n, n = 0; i < nr_pages; i++) {
+			if (status[i] == (int) node) {
+				local++;
+				continue;
+			}
+
+			pages[n++] = pages[i];
+		}
+
+		if (n == 0)
+			continue;
+
+		/* move them */
+		if (syscall(SYS_move_pages, 0, n, pages, nodes, status, MPOL_MF_MOVE) < 0) {
+			remote += n;
+			continue;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (status[i] == (int) node)
+				moved++;
+			else
+				remote++;
+		}
+	}
+
+	__atomic_fetch_add(&numa_local, local, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&numa_moved, moved, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&numa_remote, remote, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Print local versus remote placements on standard error.
+ */
+void numa_report()
+{
+	if (!numa_on)
+		return;
+
+	fprintf(stderr, "NUMA : %zu nodes, %zu sorted pages local (%zu moved), %zu remote\n", numa_nr_nodes,
+		numa_local + numa_moved, numa_moved, numa_remote);
+}
\ No newline at end of file
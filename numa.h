@@ -0,0 +1,50 @@
+#ifndef _NUMA_H_
+#define _NUMA_H_
+
+#include <stddef.h>
+
+/**
+ * @brief Enable NUMA mode (process wide, no-op on a single node machine).
+ *
+ * @return 1 if NUMA mode is enabled, 0 otherwise
+ */
+int numa_enable();
+
+/**
+ * @brief Is NUMA mode enabled ?
+ *
+ * @return 1 if NUMA mode is enabled, 0 otherwise
+ */
+int numa_enabled();
+
+/**
+ * @brief Pin calling thread to the CPUs of a node (workers are spread over nodes).
+ *
+ * @param i			worker index (node is i modulo number of nodes)
+ *
+ * @return status
+ */
+int numa_pin(size_t i);
+
+/**
+ * @brief Interleave pages of a memory range over all nodes (pages not touched yet only).
+ *
+ * @param addr			memory range
+ * @param len			memory range length
+ */
+void numa_interleave(void *addr, size_t len);
+
+/**
+ * @brief Move pages of a memory range to the node of calling thread and count placements.
+ *
+ * @param addr			memory range
+ * @param len			memory range length
+ */
+void numa_place(void *addr, size_t len);
+
+/**
+ * @brief Print local versus remote placements on standard error.
+ */
+void numa_report();
+
+#endif
\ No newline at end of file
@@ -0,0 +1,421 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "partition.h"
+#include "thread_pool.h"
+#include "mem.h"
+
+/**
+ * @brief Thread write argument.
+ */
+struct thread_write_arg {
+	struct partition *	part;
+	struct line_array *	larr;
+	size_t *		bounds;
+	size_t			i;
+	int			ret;
+};
+
+/**
+ * @brief Create a partitioned output (output files are "output_file.i").
+ * 
+ * @param output_file		output file prefix
+ * @param nr_parts		number of partitions
+ * 
+ * @return partitioned output
+ */
+struct partition *partition_create(const char *output_file, size_t nr_parts)
+{
+	struct partition *part;
+	char path[4096];
+	size_t i;
+
+	/* allocate partitioned output */
+	part = (struct partition *) xmalloc(sizeof(struct partition));
+	part->fps = (FILE **) xmalloc(sizeof(FILE *) * nr_parts);
+	part->nr_parts = 0;
+	part->splitters = NULL;
+	part->nr_splitters = 0;
+	part->current = 0;
+
+	/* open output files */
+	for (i = 0; i < nr_parts; i++) {
+		snprintf(path, sizeof(path), "%s.%zu", output_file, i);
+		remove(path);
+
+		part->fps[i] = fopen(path, "w");
+		if (!part->fps[i]) {
+			fprintf(stderr, "Can't open output file \"%s\"\n", path);
+			goto err;
+		}
+
+		part->nr_parts++;
+	}
+
+	return part;
+err:
+	partition_free(part);
+	return NULL;
+}
+
+/**
+ * @brief Free splitters.
+ * 
+ * @param part			partitioned output
+ */
+static void __free_splitters(struct partition *part)
+{
+	size_t i;
+
+	for (i = 0; i < part->nr_splitters; i++)
+		xfree(part->splitters[i].value);
+
+	xfree(part->splitters);
+	part->splitters = NULL;
+	part->nr_splitters = 0;
+}
+
+/**
+ * @brief Free a partitioned output (close output files).
+ * 
+ * @param part			partitioned output
+ *
+ * @return status
+ */
+int partition_free(struct partition *part)
+{
+	int ret = 0;
+	size_t i;
+
+	if (!part)
+		return 0;
+
+	/* close output files */
+	for (i = 0; i < part->nr_parts; i++)
+		if (fclose(part->fps[i]))
+			ret = -1;
+
+	/* free memory */
+	__free_splitters(part);
+	xfree(part->fps);
+	free(part);
+
+	return ret;
+}
+
+/**
+ * @brief Flush output files and sync them to disk.
+ * 
+ * @param part			partitioned output
+ *
+ * @return status
+ */
+int partition_sync(struct partition *part)
+{
+	size_t i;
+
+	for (i = 0; i < part->nr_parts; i++)
+		if (fflush(part->fps[i]) || fsync(fileno(part->fps[i])))
+			return -1;
+
+	return 0;
+}
+
+/**
+ * @brief Parse splitters keys.
+ * 
+ * @param s			splitters keys (separated by ',')
+ * @param splitters		splitters (output)
+ *
+ * @return number of splitters (0 if memory can't be allocated)
+ */
+size_t partition_parse_splitters(const char *s, struct line **splitters)
+{
+	size_t nr_splitters = 1, nr_dups = 0, i;
+	struct line_array *larr;
+	const char *end;
+	char *value;
+
+	/* count splitters */
+	for (end = s; (end = strchr(end, ',')) != NULL; end++)
+		nr_splitters++;
+
+	/* parse splitters (whole splitter is the key, even for binary records, transformed in a sort key in collation mode) */
+	*splitters = NULL;
+	larr = line_array_create(nr_splitters, 0);
+	if (!larr)
+		return 0;
+
+	for (i = 0; i < nr_splitters; i++, s = end + 1) {
+		end = strchrnul(s, ',');
+		value = (char *) malloc(end - s + 1);
+		if (!value)
+			goto err;
+
+		memcpy(value, s, end - s);
+		value[end - s] = 0;
+		if (line_array_add_key(larr, value, end - s)) {
+			free(value);
+			goto err;
+		}
+	}
+
+	/* copy splitters */
+	*splitters = (struct line *) malloc(sizeof(struct line) * nr_splitters);
+	if (!*splitters)
+		goto err;
+
+	for (nr_dups = 0; nr_dups < nr_splitters; nr_dups++)
+		if (line_dup(&(*splitters)[nr_dups], &larr->lines[nr_dups]))
+			goto err;
+
+	goto out;
+err:
+	if (*splitters) {
+		for (i = 0; i < nr_dups; i++)
+			free((*splitters)[i].value);
+
+		free(*splitters);
+		*splitters = NULL;
+	}
+
+	nr_splitters = 0;
+out:
+	for (i = 0; i < larr->size; i++)
+		free(larr->lines[i].value);
+
+	line_array_free(larr);
+	return nr_splitters;
+}
+
+/**
+ * @brief Set splitters keys (partition i gets keys in [splitters[i - 1], splitters[i])).
+ * 
+ * @param part			partitioned output
+ * @param splitters		splitters (sorted, owned by partitioned output)
+ * @param nr_splitters		number of splitters (= number of partitions - 1)
+ */
+void partition_set_splitters(struct partition *part, struct line *splitters, size_t nr_splitters)
+{
+	struct line_array larr;
+
+	/* sort splitters */
+	larr.lines = splitters;
+	larr.size = nr_splitters;
+	line_array_sort(&larr, 1);
+
+	__free_splitters(part);
+	part->splitters = splitters;
+	part->nr_splitters = nr_splitters;
+	part->current = 0;
+}
+
+/**
+ * @brief Add keys of a sorted line array to a sample (every step lines).
+ * 
+ * @param sample		sample
+ * @param larr			sorted line array
+ * @param step			sampling step
+ *
+ * @return status (-1 if a key can't be copied)
+ */
+int partition_add_sample(struct line_array *sample, struct line_array *larr, size_t step)
+{
+	struct line key, copy;
+	size_t i;
+
+	for (i = step / 2; i < larr->size; i += step) {
+		/* keep key only */
+		key.value = larr->lines[i].key;
+		key.value_len = larr->lines[i].key_len;
+		key.key = larr->lines[i].key;
+		key.key_len = larr->lines[i].key_len;
+
+		/* add key copy */
+		if (line_dup(&copy, &key))
+			return -1;
+		line_array_add_line(sample, &copy);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Free a sample.
+ * 
+ * @param sample		sample
+ */
+void partition_free_sample(struct line_array *sample)
+{
+	size_t i;
+
+	for (i = 0; i < sample->size; i++)
+		xfree(sample->lines[i].value);
+
+	line_array_free(sample);
+}
+
+/**
+ * @brief Compute splitters keys from a sorted sample (quantiles = equal sized partitions).
+ * 
+ * @param part			partitioned output
+ * @param sample		sorted sample
+ * @param sample_size		sample size
+ *
+ * @return status (-1 if memory can't be allocated)
+ */
+int partition_sample_splitters(struct partition *part, struct line *sample, size_t sample_size)
+{
+	struct line *splitters;
+	size_t i, j;
+
+	/* no sample : everything goes in first partition */
+	if (!sample_size) {
+		partition_set_splitters(part, NULL, 0);
+		return 0;
+	}
+
+	/* take quantiles */
+	splitters = (struct line *) malloc(sizeof(struct line) * (part->nr_parts - 1));
+	if (!splitters)
+		return -1;
+
+	for (i = 0; i < part->nr_parts - 1; i++) {
+		if (line_dup(&splitters[i], &sample[(i + 1) * sample_size / part->nr_parts])) {
+			for (j = 0; j < i; j++)
+				free(splitters[j].value);
+
+			free(splitters);
+			return -1;
+		}
+	}
+
+	partition_set_splitters(part, splitters, part->nr_parts - 1);
+	return 0;
+}
+
+/**
+ * @brief Write header lines in all partitions.
+ * 
+ * @param part			partitioned output
+ * @param header_lines		header lines
+ * @param nr_header_lines	number of header lines
+ */
+void partition_write_header(struct partition *part, char **header_lines, size_t nr_header_lines)
+{
+	size_t i, j;
+
+	for (i = 0; i < part->nr_parts; i++)
+		for (j = 0; j < nr_header_lines; j++)
+			fputs(header_lines[j], part->fps[i]);
+}
+
+/**
+ * @brief Get output file of next line (lines must be given in sorted order).
+ * 
+ * @param part			partitioned output
+ * @param line			line
+ *
+ * @return output file
+ */
+FILE *partition_output(struct partition *part, const struct line *line)
+{
+	while (part->current < part->nr_splitters && line_compare(line, &part->splitters[part->current]) >= 0)
+		part->current++;
+
+	return part->fps[part->current];
+}
+
+/**
+ * @brief Find first line greater or equal than a key.
+ * 
+ * @param larr			sorted line array
+ * @param key			key
+ *
+ * @return line index
+ */
+static size_t __lower_bound(struct line_array *larr, const struct line *key)
+{
+	size_t lo = 0, hi = larr->size, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (line_compare(&larr->lines[mid], key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**
+ * @brief Write partitions (thread pool task).
+ * 
+ * @param arg 			thread argument
+ */
+static void __write_thread(void *arg)
+{
+	struct thread_write_arg *targ = (struct thread_write_arg *) arg;
+	struct line_array larr;
+	size_t i;
+
+	for (;;) {
+		/* get next partition */
+		i = __atomic_fetch_add(&targ->i, 1, __ATOMIC_RELAXED);
+
+		/* no more partitions */
+		if (i >= targ->part->nr_parts)
+			break;
+
+		/* write partition */
+		larr.lines = targ->larr->lines + targ->bounds[i];
+		larr.size = targ->bounds[i + 1] - targ->bounds[i];
+		if (line_array_write(&larr, targ->part->fps[i]))
+			__atomic_store_n(&targ->ret, -1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * @brief Write a sorted line array in all partitions (partitions are written concurrently).
+ * 
+ * @param part			partitioned output
+ * @param larr			sorted line array
+ * @param nr_threads		number of threads to use
+ *
+ * @return status
+ */
+int partition_write(struct partition *part, struct line_array *larr, size_t nr_threads)
+{
+	struct thread_write_arg targ;
+	size_t i;
+
+	/* fix number of threads */
+	if (nr_threads < 1)
+		nr_threads = 1;
+	if (nr_threads > part->nr_parts)
+		nr_threads = part->nr_parts;
+
+	/* compute partitions bounds */
+	targ.bounds = (size_t *) xmalloc(sizeof(size_t) * (part->nr_parts + 1));
+	targ.bounds[0] = 0;
+	for (i = 1; i < part->nr_parts; i++)
+		targ.bounds[i] = i <= part->nr_splitters ? __lower_bound(larr, &part->splitters[i - 1]) : larr->size;
+	targ.bounds[part->nr_parts] = larr->size;
+
+	/* init threads arguments */
+	targ.part = part;
+	targ.larr = larr;
+	targ.i = 0;
+	targ.ret = 0;
+
+	/* write partitions on thread pool */
+	thread_pool_run(__write_thread, &targ, nr_threads);
+
+	/* free memory */
+	xfree(targ.bounds);
+
+	return targ.ret;
+}
\ No newline at end of file
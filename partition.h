@@ -0,0 +1,125 @@
+#ifndef _PARTITION_H_
+#define _PARTITION_H_
+
+#include <stdio.h>
+
+#include "line.h"
+
+/**
+ * @brief Range partitioned output.
+ */
+struct partition {
+	FILE **			fps;
+	size_t			nr_parts;
+	struct line *		splitters;
+	size_t			nr_splitters;
+	size_t			current;
+};
+
+/**
+ * @brief Create a partitioned output (output files are "output_file.i").
+ * 
+ * @param output_file		output file prefix
+ * @param nr_parts		number of partitions
+ * 
+ * @return partitioned output
+ */
+struct partition *partition_create(const char *output_file, size_t nr_parts);
+
+/**
+ * @brief Free a partitioned output (close output files).
+ * 
+ * @param part			partitioned output
+ *
+ * @return status
+ */
+int partition_free(struct partition *part);
+
+/**
+ * @brief Flush output files and sync them to disk.
+ * 
+ * @param part			partitioned output
+ *
+ * @return status
+ */
+int partition_sync(struct partition *part);
+
+/**
+ * @brief Parse splitters keys.
+ * 
+ * @param s			splitters keys (separated by ',')
+ * @param splitters		splitters (output)
+ *
+ * @return number of splitters (0 if memory can't be allocated)
+ */
+size_t partition_parse_splitters(const char *s, struct line **splitters);
+
+/**
+ * @brief Set splitters keys (partition i gets keys in [splitters[i - 1], splitters[i])).
+ * 
+ * @param part			partitioned output
+ * @param splitters		splitters (sorted, owned by partitioned output)
+ * @param nr_splitters		number of splitters (= number of partitions - 1)
+ */
+void partition_set_splitters(struct partition *part, struct line *splitters, size_t nr_splitters);
+
+/**
+ * @brief Add keys of a sorted line array to a sample (every step lines).
+ * 
+ * @param sample		sample
+ * @param larr			sorted line array
+ * @param step			sampling step
+ *
+ * @return status (-1 if a key can't be copied)
+ */
+int partition_add_sample(struct line_array *sample, struct line_array *larr, size_t step);
+
+/**
+ * @brief Free a sample.
+ * 
+ * @param sample		sample
+ */
+void partition_free_sample(struct line_array *sample);
+
+/**
+ * @brief Compute splitters keys from a sorted sample (quantiles = equal sized partitions).
+ * 
+ * @param part			partitioned output
+ * @param sample		sorted sample
+ * @param sample_size		sample size
+ *
+ * @return status (-1 if memory can't be allocated)
+ */
+int partition_sample_splitters(struct partition *part, struct line *sample, size_t sample_size);
+
+/**
+ * @brief Write header lines in all partitions.
+ * 
+ * @param part			partitioned output
+ * @param header_lines		header lines
+ * @param nr_header_lines	number of header lines
+ */
+void partition_write_header(struct partition *part, char **header_lines, size_t nr_header_lines);
+
+/**
+ * @brief Get output file of next line (lines must be given in sorted order).
+ * 
+ * @param part			partitioned output
+ * @param line			line
+ *
+ * @return output file
+ */
+FILE *partition_output(struct partition *part, const struct line *line);
+
+/**
+ * @brief Write a sorted line array in all partitions (partitions are written concurrently).
+ * 
+ * @param part			partitioned output
+ * @param larr			sorted line array
+ * @param nr_threads		number of threads to use
+ *
+ * @return status
+ */
+int partition_write(struct partition *part, struct line_array *larr, size_t nr_threads);
+
+#endif
\ No newline at end of file
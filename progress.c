@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "progress.h"
+
+#define PROGRESS_INTERVAL		1
+#define PROGRESS_STACK_SIZE		(256 * 1024)
+#define PROGRESS_MB			(1024.0 * 1024.0)
+
+/* counters (written by sorting threads, read by reporter thread) */
+static size_t progress_counters[PROGRESS_NR_COUNTERS];
+static int progress_phase = PROGRESS_START;
+static size_t progress_to_read = 0;
+static size_t progress_to_write = 0;
+
+/* progress asked by SIGUSR1 (printed by next thread updating progress) */
+static int progress_requested = 0;
+
+/* status file reporter */
+static const char *progress_status_file = NULL;
+static struct timespec progress_start;
+static pthread_t progress_thread;
+static pthread_mutex_t progress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t progress_stop_cond;
+static int progress_running = 0;
+static int progress_stop = 0;
+
+/* last sample (current throughput) */
+static double progress_last_time = 0;
+static size_t progress_last_done = 0;
+static double progress_rate = 0;
+
+static const char *progress_phases[] = { "starting", "reading", "merging", "done" };
+
+/**
+ * @brief Get a counter.
+ *
+ * @param counter		counter
+ *
+ * @return counter value
+ */
+static size_t __get(int counter)
+{
+	return __atomic_load_n(&progress_counters[counter], __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get time elapsed since start.
+ *
+ * @return elapsed time (in seconds)
+ */
+static double __elapsed()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - progress_start.tv_sec) + (now.tv_nsec - progress_start.tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Sample counters and update current throughput.
+ */
+static void __sample()
+{
+	double now = __elapsed();
+	size_t done = __get(PROGRESS_BYTES_READ) + __get(PROGRESS_BYTES_OUT);
+
+	if (now > progress_last_time)
+		progress_rate = (done - progress_last_done) / (now - progress_last_time);
+
+	progress_last_time = now;
+	progress_last_done = done;
+}
+
+/**
+ * @brief Print progress.
+ *
+ * @param fp			output file
+ */
+static void __print(FILE *fp)
+{
+	size_t read = __get(PROGRESS_BYTES_READ), written = __get(PROGRESS_BYTES_OUT);
+	size_t total = progress_to_read + progress_to_write, done = read + written;
+	int phase = __atomic_load_n(&progress_phase, __ATOMIC_RELAXED);
+	double elapsed = __elapsed();
+
+	fprintf(fp, "%s : %.1f MB read", progress_phases[phase], read / PROGRESS_MB);
+	if (progress_to_read)
+		fprintf(fp, " of %.1f MB", progress_to_read / PROGRESS_MB);
+
+	fprintf(fp, ", %zu chunks spilled, %zu/%zu runs merged, %zu lines out (%.1f MB), %.1f MB/s, %.0f s elapsed", __get(PROGRESS_CHUNKS_SPILLED),
+		__get(PROGRESS_RUNS_MERGED), __get(PROGRESS_RUNS), __get(PROGRESS_LINES_OUT), written / PROGRESS_MB, progress_rate / PROGRESS_MB, elapsed);
+
+	/* ETA : average throughput over work left (known input size only) */
+	if (phase == PROGRESS_DONE)
+		fprintf(fp, "\n");
+	else if (total && done && done < total)
+		fprintf(fp, ", ETA %.0f s\n", (total - done) * elapsed / done);
+	else
+		fprintf(fp, ", ETA unknown\n");
+}
+
+/**
+ * @brief Write status file (written aside then renamed, readers never see a partial status).
+ */
+static void __write_status()
+{
+	char path[PATH_MAX];
+	FILE *fp;
+
+	if (!progress_status_file || snprintf(path, sizeof(path), "%s.tmp", progress_status_file) >= (int) sizeof(path))
+		return;
+
+	fp = fopen(path, "w");
+	if (!fp)
+		return;
+
+	__print(fp);
+	if (fclose(fp) == 0)
+		rename(path, progress_status_file);
+}
+
+/**
+ * @brief SIGUSR1 handler : ask for progress.
+ *
+ * @param sig			signal
+ */
+static void __request(int sig)
+{
+	(void) sig;
+	__atomic_store_n(&progress_requested, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Print progress if SIGUSR1 asked for it (once, by first thread seeing the request).
+ */
+static inline void __check_request()
+{
+	if (!__atomic_load_n(&progress_requested, __ATOMIC_RELAXED) || !__atomic_exchange_n(&progress_requested, 0, __ATOMIC_RELAXED))
+		return;
+
+	/* throughput is sampled by reporter thread if any, else since last print */
+	if (!progress_running)
+		__sample();
+	__print(stderr);
+}
+
+/**
+ * @brief Reporter thread : refresh status file every second until progress_exit.
+ *
+ * @param arg			unused
+ *
+ * @return NULL
+ */
+static void *__reporter(void *arg)
+{
+	struct timespec deadline;
+
+	(void) arg;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	pthread_mutex_lock(&progress_lock);
+	for (;;) {
+		/* wait for next refresh or for stop */
+		deadline.tv_sec += PROGRESS_INTERVAL;
+		while (!progress_stop && pthread_cond_timedwait(&progress_stop_cond, &progress_lock, &deadline) != ETIMEDOUT)
+			;
+		if (progress_stop)
+			break;
+
+		pthread_mutex_unlock(&progress_lock);
+		__sample();
+		__write_status();
+		pthread_mutex_lock(&progress_lock);
+	}
+	pthread_mutex_unlock(&progress_lock);
+
+	return NULL;
+}
+
+/**
+ * @brief Start progress reporting (process wide) : progress is printed on SIGUSR1, and a reporter thread refreshes a status file.
+ *
+ * @param status_file		status file refreshed every second (NULL = SIGUSR1 only, no reporter thread)
+ *
+ * @return status
+ */
+int progress_init(const char *status_file)
+{
+	struct sigaction sa;
+	pthread_condattr_t cattr;
+	pthread_attr_t attr;
+	int ret;
+
+	progress_status_file = status_file;
+	clock_gettime(CLOCK_MONOTONIC, &progress_start);
+
+	/* SIGUSR1 only sets a flag (interrupted system calls are restarted) */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = __request;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGUSR1, &sa, NULL))
+		return -1;
+
+	/* no status file : no reporter */
+	if (!status_file)
+		return 0;
+
+	/* stop condition waits on monotonic clock */
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&progress_stop_cond, &cattr);
+	pthread_condattr_destroy(&cattr);
+
+	/* small stack : reporter must fit under the memory limit */
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, PROGRESS_STACK_SIZE);
+	ret = pthread_create(&progress_thread, &attr, __reporter, NULL);
+	pthread_attr_destroy(&attr);
+	if (ret) {
+		pthread_cond_destroy(&progress_stop_cond);
+		return -1;
+	}
+
+	progress_running = 1;
+	return 0;
+}
+
+/**
+ * @brief Set amount of work (ETA is computed on bytes read then on bytes written).
+ *
+ * @param bytes_to_read		input bytes to read (0 = unknown)
+ * @param bytes_to_write	output bytes to write (0 = unknown)
+ */
+void progress_set_work(size_t bytes_to_read, size_t bytes_to_write)
+{
+	progress_to_read = bytes_to_read;
+	progress_to_write = bytes_to_write;
+}
+
+/**
+ * @brief Set current phase.
+ *
+ * @param phase			phase (PROGRESS_*)
+ */
+void progress_set_phase(int phase)
+{
+	__atomic_store_n(&progress_phase, phase, __ATOMIC_RELAXED);
+	__check_request();
+}
+
+/**
+ * @brief Add to a counter (counters are updated by pool workers too).
+ *
+ * @param counter		counter (PROGRESS_*)
+ * @param n			value to add
+ */
+void progress_add(int counter, size_t n)
+{
+	__atomic_fetch_add(&progress_counters[counter], n, __ATOMIC_RELAXED);
+	__check_request();
+}
+
+/**
+ * @brief Stop progress reporting (status file gets final counters).
+ */
+void progress_exit()
+{
+	if (!progress_running)
+		return;
+
+	/* wake reporter and wait for it */
+	pthread_mutex_lock(&progress_lock);
+	progress_stop = 1;
+	pthread_cond_signal(&progress_stop_cond);
+	pthread_mutex_unlock(&progress_lock);
+
+	pthread_join(progress_thread, NULL);
+	pthread_cond_destroy(&progress_stop_cond);
+	progress_running = 0;
+	progress_stop = 0;
+
+	/* average throughput */
+	progress_set_phase(PROGRESS_DONE);
+	progress_last_time = __elapsed();
+	if (progress_last_time > 0)
+		progress_rate = (__get(PROGRESS_BYTES_READ) + __get(PROGRESS_BYTES_OUT)) / progress_last_time;
+	__write_status();
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+#ifndef _PROGRESS_H_
+#define _PROGRESS_H_
+
+#include <stddef.h>
+
+/* counters */
+#define PROGRESS_BYTES_READ		0
+#define PROGRESS_CHUNKS_SPILLED		1
+#define PROGRESS_RUNS			2
+#define PROGRESS_RUNS_MERGED		3
+#define PROGRESS_LINES_OUT		4
+#define PROGRESS_BYTES_OUT		5
+#define PROGRESS_NR_COUNTERS		6
+
+/* phases */
+#define PROGRESS_START			0
+#define PROGRESS_READ			1
+#define PROGRESS_MERGE			2
+#define PROGRESS_DONE			3
+
+/**
+ * @brief Start progress reporting (process wide) : progress is printed on SIGUSR1, and a reporter thread refreshes a status file.
+ *
+ * @param status_file		status file refreshed every second (NULL = SIGUSR1 only, no reporter thread)
+ *
+ * @return status
+ */
+int progress_init(const char *status_file);
+
+/**
+ * @brief Set amount of work (ETA is computed on bytes read then on bytes written).
+ *
+ * @param bytes_to_read		input bytes to read (0 = unknown)
+ * @param bytes_to_write	output bytes to write (0 = unknown)
+ */
+void progress_set_work(size_t bytes_to_read, size_t bytes_to_write);
+
+/**
+ * @brief Set current phase.
+ *
+ * @param phase			phase (PROGRESS_*)
+ */
+void progress_set_phase(int phase);
+
+/**
+ * @brief Add to a counter (counters are updated by pool workers too).
+ *
+ * @param counter		counter (PROGRESS_*)
+ * @param n			value to add
+ */
+void progress_add(int counter, size_t n);
+
+/**
+ * @brief Stop progress reporting (status file gets final counters).
+ */
+void progress_exit();
+
+#endif
\ No newline at end of file
@@ -2,10 +2,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <locale.h>
 
 #include "buffered_reader.h"
+#include "partition.h"
+#include "thread_pool.h"
+#include "numa.h"
 #include "mem.h"
 
 #define INPUT_FILE		"/home/eric/dev/data/test.txt"
@@ -18,30 +23,39 @@
 /**
  * @brief Sort a file.
  * 
- * @param input_file 		input file
- * @param output_file 		output file
+ * @param input_file 		input file ("-" for standard input)
+ * @param output_file 		output file ("-" for standard output)
  * @param field_delim 		field delimiter
  * @param key_field 		key field
  * @param header 		number of header lines
  * @param nr_threads		number of threads to use
+ * @param limit			number of lines to output (0 = all lines)
+ * @param nr_parts		number of range partitioned output files (0 = single output file)
+ * @param splitters		partitions splitters keys (NULL = quantiles)
  *
  * @return status
  */
-static int sort(const char *input_file, const char *output_file, char field_delim, int key_field, size_t header, size_t nr_threads)
+static int sort(const char *input_file, const char *output_file, char field_delim, int key_field, size_t header, size_t nr_threads, size_t limit,
+		size_t nr_parts, const char *splitters)
 {
 	FILE *fp_in = NULL, *fp_out = NULL;
 	struct buffered_reader *br = NULL;
 	struct line_array *larr = NULL;
+	struct partition *part = NULL;
+	struct line *keys;
+	size_t i, nr_keys;
+	struct stat st;
+	off_t offset;
 	int ret = -1;
-	size_t i;
 
-	/* remove output file */
-	remove(output_file);
+	/* remove output file (devices are written in place) */
+	if (strcmp(output_file, "-") && !nr_parts && !stat(output_file, &st) && S_ISREG(st.st_mode))
+		remove(output_file);
 
 	/* open input file */
-	fp_in = fopen(input_file, "r");
+	fp_in = strcmp(input_file, "-") ? fopen(input_file, "r") : stdin;
 	if (!fp_in) {
-		fprintf(stderr, "Can't open input file \"%s\"\n", output_file);
+		fprintf(stderr, "Can't open input file \"%s\"\n", input_file);
 		goto out;
 	}
 
@@ -52,24 +66,69 @@ static int sort(const char *input_file, const char *output_file, char field_deli
 
 	/* read lines */
 	larr = line_array_create(0, 0);
-	buffered_reader_read_lines(br, larr);
+	if (!larr) {
+		fprintf(stderr, "Can't allocate lines\n");
+		goto out;
+	}
 
-	/* open output file */
-	fp_out = fopen(output_file, "w");
-	if (!fp_out) {
-		fprintf(stderr, "Can't open output file \"%s\"\n", output_file);
+	if (buffered_reader_read_lines(br, larr))
 		goto out;
+
+	if (nr_parts) {
+		/* open partitioned output files */
+		part = partition_create(output_file, nr_parts);
+		if (!part)
+			goto out;
+
+		/* set splitters */
+		if (splitters) {
+			nr_keys = partition_parse_splitters(splitters, &keys);
+			if (!nr_keys) {
+				fprintf(stderr, "Can't allocate splitters\n");
+				goto out;
+			}
+
+			partition_set_splitters(part, keys, nr_keys);
+		}
+
+		/* write header */
+		partition_write_header(part, br->header_lines, br->nr_header_lines);
+	} else {
+		/* open output file */
+		fp_out = strcmp(output_file, "-") ? fopen(output_file, "w") : stdout;
+		if (!fp_out) {
+			fprintf(stderr, "Can't open output file \"%s\"\n", output_file);
+			goto out;
+		}
+
+		/* write header */
+		for (i = 0; i < br->nr_header_lines; i++)
+			fputs(br->header_lines[i], fp_out);
 	}
 
-	/* write header */
-	for (i = 0; i < br->nr_header_lines; i++)
-		fputs(br->header_lines[i], fp_out);
+	/* sort lines (or keep first lines only) */
+	if (limit)
+		line_array_limit(larr, limit, nr_threads);
+	else
+		line_array_sort(larr, nr_threads);
 
-	/* sort lines */
-	line_array_sort(larr, nr_threads);
+	/* write lines in partitions (splitters = quantiles by default) */
+	if (part) {
+		if (!splitters && partition_sample_splitters(part, larr->lines, larr->size)) {
+			fprintf(stderr, "Can't allocate splitters\n");
+			goto out;
+		}
 
-	/* write lines */
-	ret = line_array_write(larr, fp_out);
+		ret = partition_write(part, larr, nr_threads);
+		goto out;
+	}
+
+	/* write lines (regular output file : slices are written concurrently at their offsets, appended output is streamed) */
+	if (fflush(fp_out) == 0 && !fstat(fileno(fp_out), &st) && S_ISREG(st.st_mode) && !(fcntl(fileno(fp_out), F_GETFL) & O_APPEND)
+	    && (offset = ftello(fp_out)) >= 0)
+		ret = line_array_pwrite(larr, fileno(fp_out), offset, nr_threads);
+	else
+		ret = line_array_write(larr, fp_out);
 out:
 	/* free lines */
 	if (larr)
@@ -84,13 +143,140 @@ out:
 		fclose(fp_in);
 	
 	/* close output file */
-	if (fp_out)
-		fclose(fp_out);
+	if (fp_out && fclose(fp_out) && !ret) {
+		fprintf(stderr, "Can't write output file\n");
+		ret = -1;
+	}
+
+	/* close partitions */
+	if (partition_free(part) && !ret) {
+		fprintf(stderr, "Can't write output file\n");
+		ret = -1;
+	}
 
 	return ret;
 }
 
-int main()
+/**
+ * @brief Print usage.
+ * 
+ * @param name			program name
+ */
+static void usage(const char *name)
 {
-	return sort(INPUT_FILE, OUTPUT_FILE, FIELD_DELIM, KEY_FIELD, HEADER, NR_THREADS);
+	fprintf(stderr, "Usage: %s [-t field_delim] [-k key_field] [-H header] [-j nr_threads] [-N] [-l limit] [-p nr_parts | -b splitters] [-r record_size,key_offset,key_length] [-q] [-C] [-f] [-w] [-B] [-o output_file] [input_file]\n", name);
+	fprintf(stderr, "  \"-\" reads from standard input/writes to standard output\n");
+	fprintf(stderr, "  -l outputs only the first limit lines\n");
+	fprintf(stderr, "  -p writes nr_parts range partitioned output files (output_file.i) of equal sizes\n");
+	fprintf(stderr, "  -b writes range partitioned output files split at splitters keys (separated by ',')\n");
+	fprintf(stderr, "  -r sorts fixed size binary records (key is key_length bytes at key_offset, -H is ignored)\n");
+	fprintf(stderr, "  -q parses quoted CSV fields (field delimiters and newlines in double quotes)\n");
+	fprintf(stderr, "  -C compares keys in locale collation order (LC_COLLATE)\n");
+	fprintf(stderr, "  -f ignores case, -w ignores leading and trailing blanks, -B ignores leading blanks of keys\n");
+	fprintf(stderr, "  -N pins threads to NUMA nodes and moves buckets to the node sorting them (placements are reported)\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *input_file = INPUT_FILE, *output_file = OUTPUT_FILE;
+	size_t header = HEADER, nr_threads = NR_THREADS, limit = 0, nr_parts = 0;
+	size_t record_size = 0, key_off = 0, key_len = 0;
+	const char *splitters = NULL, *s;
+	char field_delim = FIELD_DELIM;
+	int key_field = KEY_FIELD, key_flags = 0, numa = 0, c, ret;
+
+	/* parse options */
+	while ((c = getopt(argc, argv, "t:k:H:j:Nl:p:b:r:qCfwBo:h")) != -1) {
+		switch (c) {
+			case 't':
+				field_delim = *optarg;
+				break;
+			case 'k':
+				key_field = atoi(optarg);
+				break;
+			case 'H':
+				header = strtoul(optarg, NULL, 10);
+				break;
+			case 'j':
+				nr_threads = strtoul(optarg, NULL, 10);
+				break;
+			case 'N':
+				numa = 1;
+				break;
+			case 'l':
+				limit = strtoul(optarg, NULL, 10);
+				break;
+			case 'p':
+				nr_parts = strtoul(optarg, NULL, 10);
+				break;
+			case 'b':
+				splitters = optarg;
+				for (nr_parts = 2, s = splitters; (s = strchr(s, ',')) != NULL; s++)
+					nr_parts++;
+				break;
+			case 'r':
+				if (sscanf(optarg, "%zu,%zu,%zu", &record_size, &key_off, &key_len) != 3 || !key_len || key_off + key_len > record_size) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'q':
+				key_flags |= LINE_KEY_CSV;
+				break;
+			case 'C':
+				setlocale(LC_COLLATE, "");
+				key_flags |= LINE_KEY_COLLATE;
+				break;
+			case 'f':
+				key_flags |= LINE_KEY_FOLD;
+				break;
+			case 'w':
+				key_flags |= LINE_KEY_TRIM;
+				break;
+			case 'B':
+				key_flags |= LINE_KEY_BLANKS;
+				break;
+			case 'o':
+				output_file = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	/* key options (binary records keys are compared as is) */
+	if (record_size && key_flags) {
+		usage(argv[0]);
+		return 1;
+	}
+	line_set_key_flags(key_flags);
+
+	/* binary records (no header) */
+	if (record_size) {
+		line_set_record_size(record_size, key_off, key_len);
+		header = 0;
+	}
+
+	/* input file */
+	if (optind < argc)
+		input_file = argv[optind];
+
+	/* partitions need output files */
+	if (nr_parts && (limit || !strcmp(output_file, "-"))) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* NUMA mode : workers spread over nodes (no-op on a single node) */
+	if (numa && numa_enable())
+		thread_pool_init(nr_threads, THREAD_POOL_PIN_NODE);
+
+	ret = sort(input_file, output_file, field_delim, key_field, header, nr_threads, limit, nr_parts, splitters);
+
+	/* stop workers */
+	thread_pool_exit();
+	numa_report();
+
+	return ret;
 }
\ No newline at end of file
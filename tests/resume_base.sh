@@ -0,0 +1,42 @@
+#!/bin/sh
+# Resumed sort with an incremental merge (-W and -I) : a sort of presorted input is killed once some runs are
+# recorded (they hold the smallest keys), then resumed with a base file. Base lines copied before the merge must
+# not belong after lines of resumed runs.
+
+ES=${ES:-./external_sort}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+fail()
+{
+	echo "resume_base: $1"
+	exit 1
+}
+
+# new data (sorted, so first runs get the smallest keys) and base file
+awk 'BEGIN { srand(1); print "id;name;value"; for (i = 0; i < 600000; i++) printf "%d;k%08d;%d\n", i, int(rand() * 100000000), i }' > "$DIR/new.txt"
+awk 'BEGIN { srand(2); print "id;name;value"; for (i = 0; i < 200000; i++) printf "%d;k%08d;%d\n", i, int(rand() * 100000000), i }' > "$DIR/base.txt"
+$ES -S 64M -o "$DIR/in.txt" "$DIR/new.txt" || fail "can't sort new data"
+$ES -S 64M -o "$DIR/base.sorted" "$DIR/base.txt" || fail "can't sort base file"
+
+# interrupt resumable sort once 2 runs are recorded
+$ES -W "$DIR/wd" -S 16M -j 1 -o "$DIR/out.txt" "$DIR/in.txt" &
+pid=$!
+i=0
+while [ $i -lt 1000 ] && [ "$(ls "$DIR/wd" 2>/dev/null | grep -vc manifest)" -lt 2 ]; do
+	sleep 0.01
+	i=$((i + 1))
+done
+kill -9 $pid 2>/dev/null
+wait $pid 2>/dev/null
+
+# resume with base file
+$ES -W "$DIR/wd" -S 16M -j 1 -I "$DIR/base.sorted" -o "$DIR/out.txt" "$DIR/in.txt" || fail "resumed sort failed"
+
+# output : header, then all lines sorted on key
+[ "$(head -n 1 "$DIR/out.txt")" = "id;name;value" ] || fail "bad header"
+tail -n +2 "$DIR/out.txt" | LC_ALL=C sort -s -c -t ';' -k 2,2 || fail "output is not sorted"
+(tail -n +2 "$DIR/in.txt"; tail -n +2 "$DIR/base.sorted") | LC_ALL=C sort > "$DIR/expected"
+tail -n +2 "$DIR/out.txt" | LC_ALL=C sort | cmp -s - "$DIR/expected" || fail "lines are lost or duplicated"
+
+echo "resume_base: OK"
\ No newline at end of file
@@ -0,0 +1,259 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "thread_pool.h"
+#include "numa.h"
+
+#define THREAD_POOL_MAX_WORKERS		256
+#define THREAD_POOL_STACK_SIZE		(256 * 1024)
+
+/* workers (created once, shared by all tasks of the process) */
+static pthread_t pool_workers[THREAD_POOL_MAX_WORKERS];
+static size_t pool_nr_workers = 0;
+static int pool_pin = THREAD_POOL_PIN_NONE;
+static int pool_stop = 0;
+
+/* queued tasks (a task leaves the queue when all its instances are started) */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static struct thread_task *pool_head = NULL;
+static struct thread_task *pool_tail = NULL;
+
+/**
+ * @brief Take an instance of a queued task (pool lock is held).
+ *
+ * @param task			task
+ */
+static void __take_instance(struct thread_task *task)
+{
+	struct thread_task **ptask, *prev = NULL;
+
+	/* instances left */
+	if (--task->nr_todo > 0)
+		return;
+
+	/* last instance : remove task from queue */
+	for (ptask = &pool_head; *ptask != task; ptask = &(*ptask)->next)
+		prev = *ptask;
+
+	*ptask = task->next;
+	if (pool_tail == task)
+		pool_tail = prev;
+}
+
+/**
+ * @brief Run an instance of a task, then count it as done.
+ *
+ * @param task			task
+ */
+static void __run_instance(struct thread_task *task)
+{
+	task->fn(task->arg);
+
+	pthread_mutex_lock(&pool_lock);
+	if (--task->nr_left == 0)
+		pthread_cond_broadcast(&pool_done);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * @brief Pin a worker to a CPU.
+ *
+ * @param i			worker index
+ */
+static void __pin_worker(size_t i)
+{
+	cpu_set_t allowed, cpu;
+	int nr_cpus, c;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		return;
+
+	nr_cpus = CPU_COUNT(&allowed);
+	if (nr_cpus <= 0)
+		return;
+
+	/* i-th allowed CPU */
+	i %= nr_cpus;
+	for (c = 0; c < CPU_SETSIZE; c++)
+		if (CPU_ISSET(c, &allowed) && i-- == 0)
+			break;
+
+	CPU_ZERO(&cpu);
+	CPU_SET(c, &cpu);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu);
+}
+
+/**
+ * @brief Worker loop.
+ *
+ * @param arg			worker index
+ *
+ * @return NULL
+ */
+static void *__worker(void *arg)
+{
+	struct thread_task *task;
+
+	if (pool_pin == THREAD_POOL_PIN_CPU)
+		__pin_worker((size_t) arg);
+	else if (pool_pin == THREAD_POOL_PIN_NODE)
+		numa_pin((size_t) arg);
+
+	for (;;) {
+		/* wait for a task */
+		pthread_mutex_lock(&pool_lock);
+		while (!pool_head && !pool_stop)
+			pthread_cond_wait(&pool_work, &pool_lock);
+
+		if (!pool_head) {
+			pthread_mutex_unlock(&pool_lock);
+			break;
+		}
+
+		task = pool_head;
+		__take_instance(task);
+		pthread_mutex_unlock(&pool_lock);
+
+		/* run it */
+		__run_instance(task);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Create workers (pool lock is held, creation failures are ignored : tasks are also run by waiting threads).
+ * Workers live as long as the process, so they get small stacks (default stacks would hold most of a -S address space limit).
+ *
+ * @param nr_threads		number of workers needed
+ */
+static void __create_workers(size_t nr_threads)
+{
+	pthread_attr_t attr;
+
+	if (nr_threads > THREAD_POOL_MAX_WORKERS)
+		nr_threads = THREAD_POOL_MAX_WORKERS;
+
+	if (pool_nr_workers >= nr_threads || pthread_attr_init(&attr))
+		return;
+
+	pthread_attr_setstacksize(&attr, THREAD_POOL_STACK_SIZE);
+	for (; pool_nr_workers < nr_threads; pool_nr_workers++)
+		if (pthread_create(&pool_workers[pool_nr_workers], &attr, __worker, (void *) pool_nr_workers))
+			break;
+
+	pthread_attr_destroy(&attr);
+}
+
+/**
+ * @brief Init process wide thread pool (workers live until thread_pool_exit, more are created if a task needs them).
+ *
+ * @param nr_threads		number of workers to create now
+ * @param pin			workers pinning (worker i runs on i-th allowed CPU or on CPUs of i-th NUMA node)
+ */
+void thread_pool_init(size_t nr_threads, int pin)
+{
+	pthread_mutex_lock(&pool_lock);
+	pool_pin = pin;
+	__create_workers(nr_threads);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * @brief Submit a task.
+ *
+ * @param task			task (caller owned)
+ * @param fn			task function
+ * @param arg			task function argument
+ * @param nr_instances		number of instances of task function to run concurrently
+ */
+void thread_pool_submit(struct thread_task *task, void (*fn)(void *), void *arg, size_t nr_instances)
+{
+	task->fn = fn;
+	task->arg = arg;
+	task->nr_todo = task->nr_left = nr_instances < 1 ? 1 : nr_instances;
+	task->next = NULL;
+
+	pthread_mutex_lock(&pool_lock);
+
+	/* enough workers to run all instances at the same time */
+	__create_workers(task->nr_todo);
+
+	/* queue task */
+	if (pool_tail)
+		pool_tail->next = task;
+	else
+		pool_head = task;
+	pool_tail = task;
+
+	pthread_cond_broadcast(&pool_work);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * @brief Wait for a task (instances not started yet are run in calling thread).
+ *
+ * @param task			task
+ */
+void thread_pool_wait(struct thread_task *task)
+{
+	pthread_mutex_lock(&pool_lock);
+
+	/* help workers (a task waiting for its sub tasks can't deadlock, no worker is needed if none could be created) */
+	while (task->nr_todo > 0) {
+		__take_instance(task);
+		pthread_mutex_unlock(&pool_lock);
+		__run_instance(task);
+		pthread_mutex_lock(&pool_lock);
+	}
+
+	/* wait for running instances */
+	while (task->nr_left > 0)
+		pthread_cond_wait(&pool_done, &pool_lock);
+
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * @brief Run a task and wait for it.
+ *
+ * @param fn			task function
+ * @param arg			task function argument
+ * @param nr_instances		number of instances of task function to run concurrently
+ */
+void thread_pool_run(void (*fn)(void *), void *arg, size_t nr_instances)
+{
+	struct thread_task task;
+
+	/* single instance : no need to wake a worker */
+	if (nr_instances <= 1) {
+		fn(arg);
+		return;
+	}
+
+	thread_pool_submit(&task, fn, arg, nr_instances);
+	thread_pool_wait(&task);
+}
+
+/**
+ * @brief Stop thread pool workers.
+ */
+void thread_pool_exit()
+{
+	size_t i;
+
+	pthread_mutex_lock(&pool_lock);
+	pool_stop = 1;
+	pthread_cond_broadcast(&pool_work);
+	pthread_mutex_unlock(&pool_lock);
+
+	for (i = 0; i < pool_nr_workers; i++)
+		pthread_join(pool_workers[i], NULL);
+
+	pool_nr_workers = 0;
+	pool_stop = 0;
+}
\ No newline at end of file
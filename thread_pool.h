@@ -0,0 +1,62 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <stddef.h>
+
+/* workers pinning */
+#define THREAD_POOL_PIN_NONE		0
+#define THREAD_POOL_PIN_CPU		1
+#define THREAD_POOL_PIN_NODE		2
+
+/**
+ * @brief Task : a function run by several workers at the same time (each instance gets the same argument
+ * and shares work with the others), owned by the caller until thread_pool_wait returns.
+ */
+struct thread_task {
+	void			(*fn)(void *arg);
+	void *			arg;
+	size_t			nr_todo;
+	size_t			nr_left;
+	struct thread_task *	next;
+};
+
+/**
+ * @brief Init process wide thread pool (workers live until thread_pool_exit, more are created if a task needs them).
+ *
+ * @param nr_threads		number of workers to create now
+ * @param pin			workers pinning (worker i runs on i-th allowed CPU or on CPUs of i-th NUMA node)
+ */
+void thread_pool_init(size_t nr_threads, int pin);
+
+/**
+ * @brief Submit a task.
+ *
+ * @param task			task (caller owned)
+ * @param fn			task function
+ * @param arg			task function argument
+ * @param nr_instances		number of instances of task function to run concurrently
+ */
+void thread_pool_submit(struct thread_task *task, void (*fn)(void *), void *arg, size_t nr_instances);
+
+/**
+ * @brief Wait for a task (instances not started yet are run in calling thread).
+ *
+ * @param task			task
+ */
+void thread_pool_wait(struct thread_task *task);
+
+/**
+ * @brief Run a task and wait for it.
+ *
+ * @param fn			task function
+ * @param arg			task function argument
+ * @param nr_instances		number of instances of task function to run concurrently
+ */
+void thread_pool_run(void (*fn)(void *), void *arg, size_t nr_instances);
+
+/**
+ * @brief Stop thread pool workers.
+ */
+void thread_pool_exit();
+
+#endif
\ No newline at end of file
@@ -0,0 +1,955 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include "tmp_file.h"
+#include "uring.h"
+#include "mem.h"
+
+#define TMP_DIR			"/tmp"
+#define TMP_ALIGN		4096
+#define TMP_BUF_SIZE		(1024 * 1024)
+#define TMP_MAX_DIRS		64
+#define TMP_NR_BLOCKS		4
+#define TMP_MIN_BLOCK_SIZE	(64 * 1024)
+#define TMP_MAX_BLOCK_SIZE	(1024 * 1024)
+#define TMP_RING_ENTRIES	256
+
+#define BLOCK_IDLE		0
+#define BLOCK_QUEUED		1
+#define BLOCK_READY		2
+
+struct tmp_file;
+
+/**
+ * @brief Asynchronous read block (taken from the spare blocks pool).
+ */
+struct tmp_block {
+	struct tmp_file *	tf;
+	char *			buf;
+	off_t			off;
+	size_t			len;
+	size_t			expected;
+	size_t			consumed;
+	int			state;
+	struct tmp_block *	next;
+};
+
+/**
+ * @brief Temporary file.
+ */
+struct tmp_file {
+	int			fd;
+	int			direct;
+	int			named;
+	int			reading;
+	int			error;
+	char *			buf;
+	size_t			buf_len;
+	size_t			buf_off;
+	off_t			off;
+	off_t			size;
+	off_t			synced;
+	off_t			dropped;
+	struct tmp_block *	first;
+	struct tmp_block *	last;
+};
+
+/* use direct I/O ? (blocking direct reads use a buffer per file, sized by merge memory) */
+static int tmp_direct = 0;
+static size_t tmp_read_buf_size = TMP_BUF_SIZE;
+
+/* asynchronous reads (io_uring and spare blocks pool, shared by all files) */
+static struct uring tmp_ring = { .fd = -1 };
+static int tmp_async = 1;
+static struct tmp_block *tmp_blocks = NULL;
+static struct tmp_block *tmp_spare = NULL;
+static size_t tmp_nr_blocks = 0;
+static size_t tmp_block_size = 0;
+
+/* temporary directories (runs are striped across them) */
+static const char *tmp_dirs[TMP_MAX_DIRS];
+static size_t tmp_nr_dirs = 0;
+static size_t tmp_next_dir = 0;
+static int tmp_by_free_space = 0;
+
+/**
+ * @brief Set temporary files I/O mode.
+ * 
+ * @param direct		use direct I/O (O_DIRECT, page cache bypassed) ?
+ */
+void tmp_file_set_direct(int direct)
+{
+	tmp_direct = direct;
+}
+
+/**
+ * @brief Set temporary files read mode.
+ * 
+ * @param async			read ahead with io_uring (fall back to blocking reads if not available) ?
+ */
+void tmp_file_set_async(int async)
+{
+	tmp_async = async;
+}
+
+/**
+ * @brief Init asynchronous reads.
+ * 
+ * @return 1 if asynchronous reads are available
+ */
+static int __async_init()
+{
+	/* already initialized or disabled */
+	if (tmp_ring.fd >= 0 || !tmp_async)
+		return tmp_async;
+
+	/* io_uring not available : fall back to blocking reads */
+	if (uring_init(&tmp_ring, TMP_RING_ENTRIES))
+		tmp_async = 0;
+
+	return tmp_async;
+}
+
+/**
+ * @brief Set read ahead memory, shared by all temporary files.
+ * 
+ * @param size			read ahead memory size
+ * @param nr_files		number of files read concurrently
+ *
+ * @return memory used for reads (read ahead blocks, or aligned buffers of blocking direct reads)
+ */
+size_t tmp_file_set_read_memory(size_t size, size_t nr_files)
+{
+	size_t i;
+
+	/* blocking reads : direct reads go through each file aligned buffer */
+	if (!__async_init()) {
+		if (!tmp_direct)
+			return 0;
+
+		tmp_read_buf_size = size / (nr_files ? nr_files : 1) / TMP_ALIGN * TMP_ALIGN;
+		if (tmp_read_buf_size < TMP_ALIGN)
+			tmp_read_buf_size = TMP_ALIGN;
+		if (tmp_read_buf_size > TMP_BUF_SIZE)
+			tmp_read_buf_size = TMP_BUF_SIZE;
+
+		return nr_files * tmp_read_buf_size;
+	}
+
+	/* pool already allocated */
+	if (tmp_blocks)
+		return tmp_nr_blocks * tmp_block_size;
+
+	/* aligned blocks, several per file */
+	tmp_block_size = size / (nr_files ? nr_files : 1) / TMP_NR_BLOCKS / TMP_ALIGN * TMP_ALIGN;
+	if (tmp_block_size < TMP_MIN_BLOCK_SIZE)
+		tmp_block_size = TMP_MIN_BLOCK_SIZE;
+	if (tmp_block_size > TMP_MAX_BLOCK_SIZE)
+		tmp_block_size = TMP_MAX_BLOCK_SIZE;
+
+	/* allocate spare blocks (keep what could be allocated) */
+	tmp_blocks = (struct tmp_block *) malloc(sizeof(struct tmp_block) * (size / tmp_block_size + 1));
+	if (!tmp_blocks)
+		return 0;
+
+	for (i = 0; i < size / tmp_block_size; i++) {
+		if (posix_memalign((void **) &tmp_blocks[i].buf, TMP_ALIGN, tmp_block_size))
+			break;
+
+		tmp_blocks[i].tf = NULL;
+		tmp_blocks[i].next = tmp_spare;
+		tmp_spare = &tmp_blocks[i];
+	}
+
+	tmp_nr_blocks = i;
+	return tmp_nr_blocks * tmp_block_size;
+}
+
+/**
+ * @brief Release temporary files resources.
+ */
+void tmp_file_exit()
+{
+	size_t i;
+
+	if (tmp_ring.fd >= 0)
+		uring_exit(&tmp_ring);
+
+	/* free spare blocks */
+	for (i = 0; i < tmp_nr_blocks; i++)
+		free(tmp_blocks[i].buf);
+	xfree(tmp_blocks);
+	tmp_blocks = tmp_spare = NULL;
+	tmp_nr_blocks = 0;
+}
+
+/**
+ * @brief Add a temporary directory.
+ * 
+ * @param dir			directory
+ *
+ * @return status
+ */
+int tmp_file_add_dir(const char *dir)
+{
+	if (tmp_nr_dirs == TMP_MAX_DIRS)
+		return -1;
+
+	tmp_dirs[tmp_nr_dirs++] = dir;
+	return 0;
+}
+
+/**
+ * @brief Set temporary files placement.
+ * 
+ * @param by_free_space		place files in directory with most free space (default = round robin) ?
+ */
+void tmp_file_set_placement(int by_free_space)
+{
+	tmp_by_free_space = by_free_space;
+}
+
+/**
+ * @brief Choose directory of next temporary file.
+ * 
+ * @return directory
+ */
+static const char *__next_dir()
+{
+	unsigned long long avail, max_avail = 0;
+	struct statvfs st;
+	size_t i, best;
+	const char *dir;
+
+	/* default directory */
+	if (!tmp_nr_dirs) {
+		dir = getenv("TMPDIR");
+		return dir ? dir : TMP_DIR;
+	}
+
+	/* round robin */
+	best = tmp_next_dir++ % tmp_nr_dirs;
+
+	/* directory with most free space */
+	if (tmp_by_free_space) {
+		for (i = 0; i < tmp_nr_dirs; i++) {
+			if (statvfs(tmp_dirs[i], &st))
+				continue;
+
+			avail = (unsigned long long) st.f_bavail * st.f_frsize;
+			if (avail > max_avail) {
+				max_avail = avail;
+				best = i;
+			}
+		}
+	}
+
+	return tmp_dirs[best];
+}
+
+/**
+ * @brief Open an anonymous file in a directory.
+ * 
+ * @param dir			directory
+ * @param flags			open flags
+ *
+ * @return file descriptor
+ */
+static int __open_anonymous(const char *dir, int flags)
+{
+	char path[4096];
+	int fd;
+
+	/* unnamed file */
+	fd = open(dir, O_TMPFILE | O_RDWR | flags, 0600);
+	if (fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR && errno != ENOENT))
+		return fd;
+
+	/* file system without O_TMPFILE : create and unlink */
+	snprintf(path, sizeof(path), "%s/sortXXXXXX", dir);
+	fd = mkostemp(path, flags);
+	if (fd >= 0)
+		unlink(path);
+
+	return fd;
+}
+
+/**
+ * @brief Write back and drop from page cache written pages.
+ * 
+ * @param tf			temporary file
+ * @param wait			wait for all pages to be written back ?
+ */
+static void __tmp_file_drop_written(struct tmp_file *tf, int wait)
+{
+	/* no page cache with direct I/O */
+	if (tf->direct)
+		return;
+
+	/* start write back of last written range */
+	if (tf->off > tf->synced) {
+		sync_file_range(tf->fd, tf->synced, tf->off - tf->synced, SYNC_FILE_RANGE_WRITE);
+		if (!wait) {
+			/* drop previous range (its write back had time to complete) */
+			if (tf->synced > tf->dropped) {
+				sync_file_range(tf->fd, tf->dropped, tf->synced - tf->dropped,
+						SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+				posix_fadvise(tf->fd, tf->dropped, tf->synced - tf->dropped, POSIX_FADV_DONTNEED);
+				tf->dropped = tf->synced;
+			}
+		}
+		tf->synced = tf->off;
+	}
+
+	/* drop everything */
+	if (wait && tf->synced > tf->dropped) {
+		sync_file_range(tf->fd, tf->dropped, tf->synced - tf->dropped,
+				SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(tf->fd, tf->dropped, tf->synced - tf->dropped, POSIX_FADV_DONTNEED);
+		tf->dropped = tf->synced;
+	}
+}
+
+/**
+ * @brief Flush write buffer.
+ * 
+ * @param tf			temporary file
+ * @param last			last write (buffer may be unaligned) ?
+ *
+ * @return status
+ */
+static int __tmp_file_flush(struct tmp_file *tf, int last)
+{
+	size_t len = tf->buf_len;
+	ssize_t n;
+
+	/* direct I/O needs aligned sizes : write unaligned tail through page cache */
+	if (last && tf->direct && len % TMP_ALIGN)
+		fcntl(tf->fd, F_SETFL, fcntl(tf->fd, F_GETFL) & ~O_DIRECT);
+
+	/* write buffer */
+	while (len > 0) {
+		n = pwrite(tf->fd, tf->buf + tf->buf_len - len, len, tf->off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		len -= n;
+		tf->off += n;
+	}
+
+	/* restore direct I/O */
+	if (last && tf->direct && tf->buf_len % TMP_ALIGN)
+		fcntl(tf->fd, F_SETFL, fcntl(tf->fd, F_GETFL) | O_DIRECT);
+
+	tf->buf_len = 0;
+	__tmp_file_drop_written(tf, last);
+
+	return 0;
+}
+
+/**
+ * @brief Write to a temporary file (cookie function).
+ * 
+ * @param cookie		temporary file
+ * @param buf			buffer
+ * @param size			buffer size
+ *
+ * @return number of bytes written
+ */
+static ssize_t __tmp_file_write(void *cookie, const char *buf, size_t size)
+{
+	struct tmp_file *tf = (struct tmp_file *) cookie;
+	size_t len, done = 0;
+
+	while (done < size) {
+		/* fill aligned buffer */
+		len = TMP_BUF_SIZE - tf->buf_len;
+		if (len > size - done)
+			len = size - done;
+		memcpy(tf->buf + tf->buf_len, buf + done, len);
+		tf->buf_len += len;
+		done += len;
+
+		/* flush full buffer */
+		if (tf->buf_len == TMP_BUF_SIZE && __tmp_file_flush(tf, 0))
+			return done > len ? (ssize_t) (done - len) : -1;
+	}
+
+	return size;
+}
+
+/**
+ * @brief Queue read of a block (deferred if too many reads are in flight).
+ * 
+ * @param b			block
+ */
+static void __block_queue(struct tmp_block *b)
+{
+	/* queue read (direct I/O needs an aligned length) */
+	if (uring_queue_read(&tmp_ring, b->tf->fd, b->buf + b->len, tmp_block_size - b->len, b->off + b->len, b))
+		b->state = BLOCK_IDLE;
+	else
+		b->state = BLOCK_QUEUED;
+}
+
+/**
+ * @brief Handle a block read completion.
+ * 
+ * @param b			block
+ * @param res			read result
+ */
+static void __block_done(struct tmp_block *b, int res)
+{
+	/* read error */
+	if (res < 0) {
+		b->tf->error = -res;
+		b->state = BLOCK_READY;
+		return;
+	}
+
+	/* short read : read remaining */
+	b->len += res;
+	if (res > 0 && b->len < b->expected) {
+		__block_queue(b);
+		return;
+	}
+
+	/* truncated file */
+	if (b->len < b->expected)
+		b->tf->error = EIO;
+
+	b->state = BLOCK_READY;
+}
+
+/**
+ * @brief Wait for a read completion (of any file).
+ * 
+ * @return status
+ */
+static int __async_wait()
+{
+	struct tmp_block *b;
+	int res;
+
+	if (uring_wait(&tmp_ring, (void **) &b, &res))
+		return -1;
+
+	__block_done(b, res);
+	return 0;
+}
+
+/**
+ * @brief Read next block of a temporary file in a spare block.
+ * 
+ * @param tf			temporary file
+ *
+ * @return block (NULL if no spare block is available or whole file is read)
+ */
+static struct tmp_block *__block_get(struct tmp_file *tf)
+{
+	struct tmp_block *b = tmp_spare;
+
+	/* no spare block or end of file */
+	if (!b || tf->off >= tf->size)
+		return NULL;
+
+	/* take spare block */
+	tmp_spare = b->next;
+	b->tf = tf;
+	b->off = tf->off;
+	b->len = 0;
+	b->consumed = 0;
+	b->expected = tf->size - tf->off < (off_t) tmp_block_size ? (size_t) (tf->size - tf->off) : tmp_block_size;
+	b->next = NULL;
+	tf->off += b->expected;
+
+	/* append it to file blocks */
+	if (tf->last)
+		tf->last->next = b;
+	else
+		tf->first = b;
+	tf->last = b;
+
+	/* queue read */
+	__block_queue(b);
+
+	return b;
+}
+
+/**
+ * @brief Give a block back to the spare blocks pool.
+ * 
+ * @param tf			temporary file
+ */
+static void __block_put(struct tmp_file *tf)
+{
+	struct tmp_block *b = tf->first;
+
+	/* remove block from file blocks */
+	tf->first = b->next;
+	if (!tf->first)
+		tf->last = NULL;
+
+	/* add it to spare blocks */
+	b->tf = NULL;
+	b->next = tmp_spare;
+	tmp_spare = b;
+}
+
+/**
+ * @brief Read from a temporary file without read ahead (no spare block).
+ * 
+ * @param tf			temporary file
+ * @param buf			buffer
+ * @param size			buffer size
+ *
+ * @return number of bytes read
+ */
+static ssize_t __sync_read(struct tmp_file *tf, char *buf, size_t size)
+{
+	ssize_t n;
+
+	/* caller buffer is not aligned : read through page cache */
+	if (tf->direct) {
+		fcntl(tf->fd, F_SETFL, fcntl(tf->fd, F_GETFL) & ~O_DIRECT);
+		tf->direct = 0;
+	}
+
+	n = pread(tf->fd, buf, size, tf->off);
+	if (n > 0) {
+		posix_fadvise(tf->fd, tf->off, n, POSIX_FADV_DONTNEED);
+		tf->off += n;
+	}
+
+	return n;
+}
+
+/**
+ * @brief Read from a temporary file asynchronously (blocks are read ahead).
+ * 
+ * @param tf			temporary file
+ * @param buf			buffer
+ * @param size			buffer size
+ *
+ * @return number of bytes read
+ */
+static ssize_t __async_read(struct tmp_file *tf, char *buf, size_t size)
+{
+	struct tmp_block *b;
+	size_t len;
+
+	/* nothing read ahead : read on demand */
+	if (!tf->first && !__block_get(tf))
+		return __sync_read(tf, buf, size);
+
+	/* wait for first block */
+	b = tf->first;
+	while (b->state != BLOCK_READY) {
+		if (b->state == BLOCK_IDLE)
+			__block_queue(b);
+		if (b->state != BLOCK_READY && __async_wait())
+			return -1;
+	}
+
+	/* read error */
+	if (tf->error) {
+		errno = tf->error;
+		return -1;
+	}
+
+	/* copy block */
+	len = b->len - b->consumed;
+	if (len > size)
+		len = size;
+	memcpy(buf, b->buf + b->consumed, len);
+	b->consumed += len;
+
+	/* block consumed : drop pages and give block back */
+	if (b->consumed == b->len) {
+		if (!tf->direct)
+			posix_fadvise(tf->fd, b->off, b->len, POSIX_FADV_DONTNEED);
+		__block_put(tf);
+	}
+
+	return len;
+}
+
+/**
+ * @brief Get read ahead tail of a temporary file (to forecast which file needs to be read next).
+ * 
+ * @param tf			temporary file
+ * @param tail			last block read ahead (output)
+ * @param tail_len		last block length (output, 0 if nothing is read ahead)
+ *
+ * @return status (-1 if file can't be read ahead : read in flight or whole file read)
+ */
+int tmp_file_forecast(struct tmp_file *tf, char **tail, size_t *tail_len)
+{
+	/* no read ahead, read in flight, error or whole file read */
+	if (!tmp_spare || tf->error || tf->off >= tf->size || (tf->last && tf->last->state != BLOCK_READY))
+		return -1;
+
+	*tail = tf->last ? tf->last->buf : NULL;
+	*tail_len = tf->last ? tf->last->len : 0;
+	return 0;
+}
+
+/**
+ * @brief Read ahead next block of a temporary file (read is submitted by tmp_file_submit()).
+ * 
+ * @param tf			temporary file
+ *
+ * @return status (-1 if no spare block is available)
+ */
+int tmp_file_prefetch(struct tmp_file *tf)
+{
+	return __block_get(tf) ? 0 : -1;
+}
+
+/**
+ * @brief Handle completed reads (without waiting).
+ */
+void tmp_file_poll()
+{
+	struct tmp_block *b;
+	int res;
+
+	if (tmp_ring.fd < 0)
+		return;
+
+	while (!uring_peek(&tmp_ring, (void **) &b, &res))
+		__block_done(b, res);
+}
+
+/**
+ * @brief Submit queued reads.
+ */
+void tmp_file_submit()
+{
+	if (tmp_ring.fd >= 0)
+		uring_submit(&tmp_ring);
+}
+
+/**
+ * @brief Read from a temporary file (cookie function).
+ * 
+ * @param cookie		temporary file
+ * @param buf			buffer
+ * @param size			buffer size
+ *
+ * @return number of bytes read
+ */
+static ssize_t __tmp_file_read(void *cookie, char *buf, size_t size)
+{
+	struct tmp_file *tf = (struct tmp_file *) cookie;
+	size_t len;
+	ssize_t n;
+
+	/* asynchronous read */
+	if (__async_init())
+		return __async_read(tf, buf, size);
+
+	/* buffered read : read directly in caller buffer, drop pages and start reading next pages
+	   (so that runs on all devices are read concurrently while merging) */
+	if (!tf->direct) {
+		n = pread(tf->fd, buf, size, tf->off);
+		if (n > 0) {
+			posix_fadvise(tf->fd, tf->off, n, POSIX_FADV_DONTNEED);
+			tf->off += n;
+			posix_fadvise(tf->fd, tf->off, n, POSIX_FADV_WILLNEED);
+		}
+
+		return n;
+	}
+
+	/* direct read : allocate aligned buffer on first read (counted in merge memory) */
+	if (!tf->buf && posix_memalign((void **) &tf->buf, TMP_ALIGN, tmp_read_buf_size)) {
+		tf->buf = NULL;
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* refill aligned buffer */
+	if (tf->buf_off == tf->buf_len) {
+		n = pread(tf->fd, tf->buf, tmp_read_buf_size, tf->off);
+		if (n <= 0)
+			return n;
+
+		tf->buf_len = n;
+		tf->buf_off = 0;
+		tf->off += n;
+	}
+
+	/* copy buffer */
+	len = tf->buf_len - tf->buf_off;
+	if (len > size)
+		len = size;
+	memcpy(buf, tf->buf + tf->buf_off, len);
+	tf->buf_off += len;
+
+	return len;
+}
+
+/**
+ * @brief Seek a temporary file (cookie function, only rewind is supported).
+ * 
+ * @param cookie		temporary file
+ * @param offset		offset
+ * @param whence		whence
+ *
+ * @return status
+ */
+static int __tmp_file_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct tmp_file *tf = (struct tmp_file *) cookie;
+
+	/* tell */
+	if (whence == SEEK_CUR && *offset == 0 && tf->first) {
+		*offset = tf->first->off + (off_t) tf->first->consumed;
+		return 0;
+	} else if (whence == SEEK_CUR && *offset == 0) {
+		*offset = tf->reading ? tf->off - (off_t) (tf->buf_len - tf->buf_off) : tf->off + (off_t) tf->buf_len;
+		return 0;
+	}
+
+	/* only rewind is supported */
+	if (whence != SEEK_SET || *offset != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* end of write : flush buffer */
+	if (!tf->reading) {
+		if (__tmp_file_flush(tf, 1))
+			return -1;
+
+		tf->reading = 1;
+		tf->size = tf->off;
+
+		/* named file : make it durable */
+		if (tf->named && fdatasync(tf->fd))
+			return -1;
+	}
+
+	/* blocks read ahead can't be rewound */
+	if (tf->first) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* free write or read buffer (blocking direct reads allocate it again, with merge buffer size, on next read) */
+	free(tf->buf);
+	tf->buf = NULL;
+
+	/* prepare sequential read */
+	tf->off = 0;
+	tf->buf_len = 0;
+	tf->buf_off = 0;
+	posix_fadvise(tf->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	return 0;
+}
+
+/**
+ * @brief Close a temporary file (cookie function).
+ * 
+ * @param cookie		temporary file
+ *
+ * @return status
+ */
+static int __tmp_file_close(void *cookie)
+{
+	struct tmp_file *tf = (struct tmp_file *) cookie;
+	int ret;
+
+	/* wait for reads in flight (they target blocks buffers) and give blocks back */
+	while (tf->first) {
+		while (tf->first->state == BLOCK_QUEUED)
+			if (__async_wait())
+				break;
+
+		__block_put(tf);
+	}
+
+	ret = close(tf->fd);
+	free(tf->buf);
+	free(tf);
+
+	return ret;
+}
+
+/**
+ * @brief Allocate a temporary file.
+ * 
+ * @param direct		use direct I/O ?
+ * @param buffer		allocate aligned buffer (writes and blocking direct reads) ?
+ * 
+ * @return temporary file
+ */
+static struct tmp_file *__tmp_file_alloc(int direct, int buffer)
+{
+	struct tmp_file *tf;
+
+	tf = (struct tmp_file *) malloc(sizeof(struct tmp_file));
+	if (!tf)
+		return NULL;
+
+	tf->fd = -1;
+	tf->direct = direct;
+	tf->named = 0;
+	tf->reading = 0;
+	tf->error = 0;
+	tf->buf_len = 0;
+	tf->buf_off = 0;
+	tf->off = 0;
+	tf->size = 0;
+	tf->synced = 0;
+	tf->dropped = 0;
+	tf->first = NULL;
+	tf->last = NULL;
+	tf->buf = NULL;
+
+	/* allocate aligned buffer */
+	if (buffer && posix_memalign((void **) &tf->buf, TMP_ALIGN, TMP_BUF_SIZE)) {
+		free(tf);
+		return NULL;
+	}
+
+	return tf;
+}
+
+/**
+ * @brief Create a temporary file stream.
+ * 
+ * @param tf			temporary file
+ * @param mode			stream mode
+ * @param handle		temporary file handle (output, optional)
+ * 
+ * @return temporary file stream
+ */
+static FILE *__tmp_file_stream(struct tmp_file *tf, const char *mode, struct tmp_file **handle)
+{
+	cookie_io_functions_t io = {
+		.read		= __tmp_file_read,
+		.write		= __tmp_file_write,
+		.seek		= __tmp_file_seek,
+		.close		= __tmp_file_close,
+	};
+	FILE *fp;
+
+	/* create stream */
+	fp = fopencookie(tf, mode, io);
+	if (!fp) {
+		if (tf->fd >= 0)
+			close(tf->fd);
+		free(tf->buf);
+		free(tf);
+		return NULL;
+	}
+
+	if (handle)
+		*handle = tf;
+
+	return fp;
+}
+
+/**
+ * @brief Create a temporary file (written once, rewound then read once).
+ * 
+ * @param size_hint		expected file size (0 = unknown)
+ * @param path			file path (NULL = anonymous file in temporary directories)
+ * @param handle		temporary file handle, to schedule read ahead (output, optional)
+ * 
+ * @return temporary file
+ */
+FILE *tmp_file_create(size_t size_hint, const char *path, struct tmp_file **handle)
+{
+	struct tmp_file *tf;
+	const char *dir;
+
+	/* allocate temporary file */
+	tf = __tmp_file_alloc(tmp_direct, 1);
+	if (!tf)
+		return NULL;
+
+	/* open file (file systems without direct I/O fall back to buffered I/O) */
+	if (path) {
+		tf->named = 1;
+		tf->fd = open(path, O_CREAT | O_TRUNC | O_RDWR | (tf->direct ? O_DIRECT : 0), 0600);
+		if (tf->fd < 0 && tf->direct) {
+			tf->direct = 0;
+			tf->fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0600);
+		}
+	} else {
+		dir = __next_dir();
+		tf->fd = __open_anonymous(dir, tf->direct ? O_DIRECT : 0);
+		if (tf->fd < 0 && tf->direct) {
+			tf->direct = 0;
+			tf->fd = __open_anonymous(dir, 0);
+		}
+	}
+	if (tf->fd < 0)
+		goto err;
+
+	/* preallocate space */
+	if (size_hint)
+		fallocate(tf->fd, FALLOC_FL_KEEP_SIZE, 0, size_hint);
+
+	return __tmp_file_stream(tf, "w+", handle);
+err:
+	free(tf->buf);
+	free(tf);
+	return NULL;
+}
+
+/**
+ * @brief Open an existing named file for reading (same reads as a rewound temporary file).
+ * 
+ * @param path			file path
+ * @param handle		temporary file handle, to schedule read ahead (output, optional)
+ * 
+ * @return temporary file
+ */
+FILE *tmp_file_open(const char *path, struct tmp_file **handle)
+{
+	struct tmp_file *tf;
+	struct stat st;
+
+	/* allocate temporary file (no buffer : blocking direct reads allocate it on first read) */
+	tf = __tmp_file_alloc(tmp_direct, 0);
+	if (!tf)
+		return NULL;
+
+	/* open file */
+	tf->fd = open(path, O_RDONLY | (tf->direct ? O_DIRECT : 0));
+	if (tf->fd < 0 && tf->direct) {
+		tf->direct = 0;
+		tf->fd = open(path, O_RDONLY);
+	}
+	if (tf->fd < 0 || fstat(tf->fd, &st))
+		goto err;
+
+	/* ready to read */
+	tf->named = 1;
+	tf->reading = 1;
+	tf->size = st.st_size;
+	posix_fadvise(tf->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	return __tmp_file_stream(tf, "r", handle);
+err:
+	if (tf->fd >= 0)
+		close(tf->fd);
+	free(tf->buf);
+	free(tf);
+	return NULL;
+}
\ No newline at end of file
@@ -0,0 +1,108 @@
+#ifndef _TMP_FILE_H_
+#define _TMP_FILE_H_
+
+#include <stdio.h>
+
+struct tmp_file;
+
+/**
+ * @brief Set temporary files I/O mode.
+ * 
+ * @param direct		use direct I/O (O_DIRECT, page cache bypassed) ?
+ */
+void tmp_file_set_direct(int direct);
+
+/**
+ * @brief Set temporary files read mode.
+ * 
+ * @param async			read ahead with io_uring (fall back to blocking reads if not available) ?
+ */
+void tmp_file_set_async(int async);
+
+/**
+ * @brief Set read ahead memory, shared by all temporary files.
+ * 
+ * @param size			read ahead memory size
+ * @param nr_files		number of files read concurrently
+ *
+ * @return memory used for reads (read ahead blocks, or aligned buffers of blocking direct reads)
+ */
+size_t tmp_file_set_read_memory(size_t size, size_t nr_files);
+
+/**
+ * @brief Get read ahead tail of a temporary file (to forecast which file needs to be read next).
+ * 
+ * @param tf			temporary file
+ * @param tail			last block read ahead (output)
+ * @param tail_len		last block length (output, 0 if nothing is read ahead)
+ *
+ * @return status (-1 if file can't be read ahead : read in flight or whole file read)
+ */
+int tmp_file_forecast(struct tmp_file *tf, char **tail, size_t *tail_len);
+
+/**
+ * @brief Read ahead next block of a temporary file (read is submitted by tmp_file_submit()).
+ * 
+ * @param tf			temporary file
+ *
+ * @return status (-1 if no spare block is available)
+ */
+int tmp_file_prefetch(struct tmp_file *tf);
+
+/**
+ * @brief Handle completed reads (without waiting).
+ */
+void tmp_file_poll();
+
+/**
+ * @brief Submit queued reads.
+ */
+void tmp_file_submit();
+
+/**
+ * @brief Release temporary files resources.
+ */
+void tmp_file_exit();
+
+/**
+ * @brief Add a temporary directory (runs are striped across temporary directories, default = $TMPDIR or /tmp).
+ * 
+ * @param dir			directory
+ *
+ * @return status
+ */
+int tmp_file_add_dir(const char *dir);
+
+/**
+ * @brief Set temporary files placement.
+ * 
+ * @param by_free_space		place files in directory with most free space (default = round robin) ?
+ */
+void tmp_file_set_placement(int by_free_space);
+
+/**
+ * @brief Create a temporary file (written once, rewound then read once).
+ * 
+ * Writes and reads go through an aligned buffer (optionally with O_DIRECT), space is preallocated
+ * and pages are dropped from page cache once written back or read, to keep sort cache footprint small.
+ * Named files are made durable (fdatasync) when rewound.
+ * 
+ * @param size_hint		expected file size (0 = unknown)
+ * @param path			file path (NULL = anonymous file in temporary directories)
+ * @param handle		temporary file handle, to schedule read ahead (output, optional)
+ * 
+ * @return temporary file
+ */
+FILE *tmp_file_create(size_t size_hint, const char *path, struct tmp_file **handle);
+
+/**
+ * @brief Open an existing named file for reading (same reads as a rewound temporary file).
+ * 
+ * @param path			file path
+ * @param handle		temporary file handle, to schedule read ahead (output, optional)
+ * 
+ * @return temporary file
+ */
+FILE *tmp_file_open(const char *path, struct tmp_file **handle);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,227 @@
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+/**
+ * @brief Init an io_uring.
+ * 
+ * @param ring			io_uring
+ * @param entries		number of submission entries
+ *
+ * @return status (-1 if io_uring is not available)
+ */
+int uring_init(struct uring *ring, unsigned entries)
+{
+	struct io_uring_params p;
+
+	/* setup ring */
+	memset(ring, 0, sizeof(struct uring));
+	memset(&p, 0, sizeof(struct io_uring_params));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0)
+		return -1;
+
+	/* map submission queue */
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED)
+		goto err;
+
+	/* map completion queue */
+	ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	if (ring->cq_ptr == MAP_FAILED)
+		goto err;
+
+	/* map submission entries */
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto err;
+
+	/* set pointers */
+	ring->sq_head = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.head);
+	ring->sq_tail = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.tail);
+	ring->sq_mask = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) ((char *) ring->sq_ptr + p.sq_off.array);
+	ring->cq_head = (unsigned *) ((char *) ring->cq_ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned *) ((char *) ring->cq_ptr + p.cq_off.tail);
+	ring->cq_mask = (unsigned *) ((char *) ring->cq_ptr + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ptr + p.cq_off.cqes);
+	ring->sq_entries = p.sq_entries;
+	ring->cq_entries = p.cq_entries;
+
+	return 0;
+err:
+	uring_exit(ring);
+	return -1;
+}
+
+/**
+ * @brief Release an io_uring.
+ * 
+ * @param ring			io_uring
+ */
+void uring_exit(struct uring *ring)
+{
+	if (ring->sqes && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED)
+		munmap(ring->cq_ptr, ring->cq_len);
+	if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED)
+		munmap(ring->sq_ptr, ring->sq_len);
+	if (ring->fd >= 0)
+		close(ring->fd);
+
+	memset(ring, 0, sizeof(struct uring));
+	ring->fd = -1;
+}
+
+/**
+ * @brief Queue a read (submitted in batch by next uring_submit or uring_wait).
+ * 
+ * @param ring			io_uring
+ * @param fd			file descriptor
+ * @param buf			buffer
+ * @param len			length
+ * @param off			file offset
+ * @param data			user data (returned on completion)
+ *
+ * @return status (-1 if too many requests are in flight)
+ */
+int uring_queue_read(struct uring *ring, int fd, void *buf, size_t len, off_t off, void *data)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+
+	/* completion queue must never overflow */
+	if (ring->nr_inflight + ring->nr_queued >= ring->cq_entries)
+		return -1;
+
+	/* submission queue full : submit queued requests */
+	if (ring->nr_queued == ring->sq_entries && uring_submit(ring))
+		return -1;
+
+	/* fill submission entry */
+	tail = *ring->sq_tail;
+	idx = tail & *ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long) buf;
+	sqe->len = len;
+	sqe->off = off;
+	sqe->user_data = (unsigned long) data;
+	ring->sq_array[idx] = idx;
+
+	/* publish entry */
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->nr_queued++;
+
+	return 0;
+}
+
+/**
+ * @brief Submit queued requests.
+ * 
+ * @param ring			io_uring
+ *
+ * @return status
+ */
+int uring_submit(struct uring *ring)
+{
+	int ret;
+
+	while (ring->nr_queued > 0) {
+		ret = syscall(__NR_io_uring_enter, ring->fd, ring->nr_queued, 0, 0, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+
+		ring->nr_queued -= ret;
+		ring->nr_inflight += ret;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Pop a completion.
+ * 
+ * @param ring			io_uring
+ * @param data			completed request user data (output)
+ * @param res			completed request result (output)
+ *
+ * @return status (-1 if no completion is available)
+ */
+static int __uring_pop(struct uring *ring, void **data, int *res)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head;
+
+	/* no completion available */
+	head = *ring->cq_head;
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return -1;
+
+	/* pop completion */
+	cqe = &ring->cqes[head & *ring->cq_mask];
+	*data = (void *) (unsigned long) cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	ring->nr_inflight--;
+
+	return 0;
+}
+
+/**
+ * @brief Submit queued requests and wait for a completion.
+ * 
+ * @param ring			io_uring
+ * @param data			completed request user data (output)
+ * @param res			completed request result (output)
+ *
+ * @return status
+ */
+int uring_wait(struct uring *ring, void **data, int *res)
+{
+	int ret;
+
+	/* submit queued requests */
+	if (uring_submit(ring))
+		return -1;
+
+	/* wait for a completion */
+	while (__uring_pop(ring, data, res)) {
+		/* nothing in flight */
+		if (!ring->nr_inflight)
+			return -1;
+
+		ret = syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0 && errno != EINTR)
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Get a completion without waiting.
+ * 
+ * @param ring			io_uring
+ * @param data			completed request user data (output)
+ * @param res			completed request result (output)
+ *
+ * @return status (-1 if no completion is available)
+ */
+int uring_peek(struct uring *ring, void **data, int *res)
+{
+	return __uring_pop(ring, data, res);
+}
\ No newline at end of file
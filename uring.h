@@ -0,0 +1,95 @@
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <linux/io_uring.h>
+
+/**
+ * @brief Minimal io_uring (raw system calls, no liburing needed).
+ */
+struct uring {
+	int			fd;
+	void *			sq_ptr;
+	size_t			sq_len;
+	void *			cq_ptr;
+	size_t			cq_len;
+	struct io_uring_sqe *	sqes;
+	size_t			sqes_len;
+	unsigned *		sq_head;
+	unsigned *		sq_tail;
+	unsigned *		sq_mask;
+	unsigned *		sq_array;
+	unsigned *		cq_head;
+	unsigned *		cq_tail;
+	unsigned *		cq_mask;
+	struct io_uring_cqe *	cqes;
+	unsigned		sq_entries;
+	unsigned		cq_entries;
+	unsigned		nr_queued;
+	unsigned		nr_inflight;
+};
+
+/**
+ * @brief Init an io_uring.
+ * 
+ * @param ring			io_uring
+ * @param entries		number of submission entries
+ *
+ * @return status (-1 if io_uring is not available)
+ */
+int uring_init(struct uring *ring, unsigned entries);
+
+/**
+ * @brief Release an io_uring.
+ * 
+ * @param ring			io_uring
+ */
+void uring_exit(struct uring *ring);
+
+/**
+ * @brief Queue a read (submitted in batch by next uring_submit or uring_wait).
+ * 
+ * @param ring			io_uring
+ * @param fd			file descriptor
+ * @param buf			buffer
+ * @param len			length
+ * @param off			file offset
+ * @param data			user data (returned on completion)
+ *
+ * @return status (-1 if too many requests are in flight)
+ */
+int uring_queue_read(struct uring *ring, int fd, void *buf, size_t len, off_t off, void *data);
+
+/**
+ * @brief Submit queued requests.
+ * 
+ * @param ring			io_uring
+ *
+ * @return status
+ */
+int uring_submit(struct uring *ring);
+
+/**
+ * @brief Submit queued requests and wait for a completion.
+ * 
+ * @param ring			io_uring
+ * @param data			completed request user data (output)
+ * @param res			completed request result (output)
+ *
+ * @return status
+ */
+int uring_wait(struct uring *ring, void **data, int *res);
+
+/**
+ * @brief Get a completion without waiting.
+ * 
+ * @param ring			io_uring
+ * @param data			completed request user data (output)
+ * @param res			completed request result (output)
+ *
+ * @return status (-1 if no completion is available)
+ */
+int uring_peek(struct uring *ring, void **data, int *res);
+
+#endif
\ No newline at end of file